@@ -27,7 +27,7 @@ src="./src/main.cpp " # ./src/platform.c ./src/common.c "
 # commands+="-march=x86-64-v2 " (close to Haswell) AVX, AVX2, BMI1, BMI2, F16C, FMA, LZCNT, MOVBE, XSAVE
 # commands+="-march=x86-64-v3 " AVX512F, AVX512BW, AVX512CD, AVX512DQ, AVX512VL
 # commands+="-march=x86-64-v4 "
-common="-x c++ -std=c++11 $src -o bin/main -DTERMCOLOR=1 -mno-incremental-linker-compatible -Wno-writable-strings -Wno-tautological-compare -Wno-unused-value -fwritable-strings -MJ compile_commands.json_ "
+common="-x c++ -std=c++11 $src -o bin/main -DTERMCOLOR=1 -mno-incremental-linker-compatible -Wno-writable-strings -Wno-tautological-compare -Wno-unused-value -fwritable-strings -pthread -MJ compile_commands.json_ "
 # common+="-march=x86-64-v2 -mavx2 -ffast-math "
 # common+="-march=x86-64-v2 "
 
@@ -40,6 +40,9 @@ common="-x c++ -std=c++11 $src -o bin/main -DTERMCOLOR=1 -mno-incremental-linker
 #### Option B: Optimized.
 clang++ -g -O2 -DNDEBUG -DASSERT_LEVEL=1 -DDEBUG_PRINT $common
 
+#### (Example) Optimized, with the allocation profiler ("--alloc-report").
+# clang++ -g -O2 -DNDEBUG -DASSERT_LEVEL=1 -DDEBUG_PRINT -DDEBUG_ALLOCATIONS $common
+
 #### (Example) Address sanitizer.
 # clang++ -O0 -g $common fsanitize=address -fno-omit-frame-pointer
 
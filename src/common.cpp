@@ -1,6 +1,13 @@
 #include "platform.h"
 #include "common.h"
 
+#if __SSE2__
+    #include <emmintrin.h>
+#endif
+#if DEBUG_ALLOCATIONS
+    #include <stdlib.h>
+#endif
+
 // ---------------------------------------------------------------------------------------
 
 template <typename T>
@@ -14,32 +21,32 @@ void CopyCount(T * Dst, const T * RESTRICT Src, usize Count) {
 }
 
 template <typename T>
-T * MallocCount(usize Count) {
-    auto Result = Malloc(Count * sizeof(T));
+T * MallocCount(usize Count, call_site Site) {
+    auto Result = Malloc_(Count * sizeof(T), Site.Function);
     return (T *)Result;
 }
 
 // ---------------------------------------------------------------------------------------
 
 template <typename T>
-array<T>::array(usize Capacity) {
+array<T>::array(usize Capacity, call_site Site) {
     this->Count = 0;
     this->Capacity = Capacity;
-    this->Data = MallocCount<T>(Capacity);
+    this->Data = MallocCount<T>(Capacity, Site);
 }
 
 template <typename T>
-array<T>::array() {
+array<T>::array(call_site Site) {
     this->Count = 0;
     this->Capacity = 10;
-    this->Data = MallocCount<T>(this->Capacity);
+    this->Data = MallocCount<T>(this->Capacity, Site);
 }
 
 template <typename T>
-void array<T>::Reserve(usize NewCapacity) {
+void array<T>::Reserve(usize NewCapacity, call_site Site) {
     if (NewCapacity <= this->Capacity) return;
 
-    T *New = MallocCount<T>(NewCapacity);
+    T *New = MallocCount<T>(NewCapacity, Site);
     CopyCount(New, this->Data, this->Count);
     Free(this->Data);
 
@@ -48,26 +55,714 @@ void array<T>::Reserve(usize NewCapacity) {
 }
 
 template <typename T>
-T * array<T>::Push() {
+T * array<T>::Push(call_site Site) {
     if (this->Count == this->Capacity) {
-        Reserve(this->Capacity * 2);
+        Reserve(this->Capacity * 2, Site);
     }
     return &this->Data[this->Count++];
 }
 
 template <typename T>
-T * array<T>::Push(const T &Item) {
-    auto New = Push();
+T * array<T>::Push(const T &Item, call_site Site) {
+    auto New = Push(Site);
     CopyCount(New, Item, 1);
     return New;
 }
 
 template <typename T>
-T * array<T>::Push(T *Item) {
-    auto Result = Push(*Item);
+T * array<T>::Push(T *Item, call_site Site) {
+    auto Result = Push(*Item, Site);
     return Result;
 }
 
+// Heapsort: in place, no allocations, O(n log n) worst case.
+template <typename T, typename L>
+void SiftDown(T *Data, usize Root, usize Count, L &Less) {
+    for (;;) {
+        usize Child = 2 * Root + 1;
+        if (Child >= Count) return;
+        if (Child + 1 < Count && Less(Data[Child], Data[Child + 1])) Child += 1;
+        if (!Less(Data[Root], Data[Child])) return;
+        T Swap = Data[Root]; Data[Root] = Data[Child]; Data[Child] = Swap;
+        Root = Child;
+    }
+}
+
+template <typename T, typename L>
+void Sort(T *Data, usize Count, L Less) {
+    if (Count < 2) return;
+    for (usize I = Count / 2; I-- > 0;) SiftDown(Data, I, Count, Less);
+    for (usize End = Count - 1; End > 0; --End) {
+        T Swap = Data[0]; Data[0] = Data[End]; Data[End] = Swap;
+        SiftDown(Data, 0, End, Less);
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+
+#define XXH_PRIME1 0x9E3779B185EBCA87llu
+#define XXH_PRIME2 0xC2B2AE3D27D4EB4Fllu
+#define XXH_PRIME3 0x165667B19E3779F9llu
+#define XXH_PRIME4 0x85EBCA77C2B2AE63llu
+#define XXH_PRIME5 0x27D4EB2F165667C5llu
+
+static inline INLINE u64 Rotl64(u64 X, int R) { return (X << R) | (X >> (64 - R)); }
+static inline INLINE u64 Read64(const u8 *P) { u64 V; __builtin_memcpy(&V, P, 8); return V; }
+static inline INLINE u32 Read32(const u8 *P) { u32 V; __builtin_memcpy(&V, P, 4); return V; }
+
+static inline INLINE u64 XxhRound(u64 Acc, u64 Input) {
+    Acc += Input * XXH_PRIME2;
+    Acc  = Rotl64(Acc, 31);
+    return Acc * XXH_PRIME1;
+}
+
+static inline INLINE u64 XxhMerge(u64 Acc, u64 Lane) {
+    Acc ^= XxhRound(0, Lane);
+    return Acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+// Four independent lanes over 32 byte stripes, which the compiler keeps in registers
+// (and vectorizes where it can).
+u64 Hash64(const void *Data, usize Size, u64 Seed) {
+    auto P   = (const u8 *)Data;
+    auto End = P + Size;
+    u64 Hash;
+
+    if (Size >= 32) {
+        u64 V1 = Seed + XXH_PRIME1 + XXH_PRIME2;
+        u64 V2 = Seed + XXH_PRIME2;
+        u64 V3 = Seed;
+        u64 V4 = Seed - XXH_PRIME1;
+        auto Limit = End - 32;
+        do {
+            V1 = XxhRound(V1, Read64(P));      P += 8;
+            V2 = XxhRound(V2, Read64(P));      P += 8;
+            V3 = XxhRound(V3, Read64(P));      P += 8;
+            V4 = XxhRound(V4, Read64(P));      P += 8;
+        } while (P <= Limit);
+
+        Hash = Rotl64(V1, 1) + Rotl64(V2, 7) + Rotl64(V3, 12) + Rotl64(V4, 18);
+        Hash = XxhMerge(Hash, V1);
+        Hash = XxhMerge(Hash, V2);
+        Hash = XxhMerge(Hash, V3);
+        Hash = XxhMerge(Hash, V4);
+    } else {
+        Hash = Seed + XXH_PRIME5;
+    }
+
+    Hash += (u64)Size;
+
+    for (; P + 8 <= End; P += 8) {
+        Hash ^= XxhRound(0, Read64(P));
+        Hash  = Rotl64(Hash, 27) * XXH_PRIME1 + XXH_PRIME4;
+    }
+    if (P + 4 <= End) {
+        Hash ^= (u64)Read32(P) * XXH_PRIME1;
+        Hash  = Rotl64(Hash, 23) * XXH_PRIME2 + XXH_PRIME3;
+        P += 4;
+    }
+    for (; P < End; ++P) {
+        Hash ^= (*P) * XXH_PRIME5;
+        Hash  = Rotl64(Hash, 11) * XXH_PRIME1;
+    }
+
+    Hash ^= Hash >> 33;
+    Hash *= XXH_PRIME2;
+    Hash ^= Hash >> 29;
+    Hash *= XXH_PRIME3;
+    Hash ^= Hash >> 32;
+    return Hash;
+}
+
+// ---------------------------------------------------------------------------------------
+
+#define THROTTLE_BURST_SECONDS 0.05 // Small buckets: pace smoothly instead of in bursts.
+
+static void BucketInit(token_bucket *Bucket, double Rate) {
+    Bucket->Rate   = Rate;
+    Bucket->Burst  = MAX(Rate * THROTTLE_BURST_SECONDS, 1.0);
+    Bucket->Tokens = Bucket->Burst;
+    Bucket->Last   = Nanoseconds();
+}
+
+static u64 BucketDelay(token_bucket *Bucket, u64 Now) {
+    if (Bucket->Rate <= 0) return 0;
+
+    Bucket->Tokens = MIN(Bucket->Burst, Bucket->Tokens + Bucket->Rate * (double)(Now - Bucket->Last) / 1e9);
+    Bucket->Last   = Now;
+    if (Bucket->Tokens > 0) return 0;
+
+    return (u64)((-Bucket->Tokens / Bucket->Rate) * 1e9) + 1;
+}
+
+void ThrottleInit(throttle *Throttle, double OperationsPerSecond, double BytesPerSecond) {
+    BucketInit(&Throttle->Operations, OperationsPerSecond);
+    BucketInit(&Throttle->Bytes, BytesPerSecond);
+    Throttle->Lock = 0;
+}
+
+u64 ThrottleDelay(throttle *Throttle, u64 Operations, u64 Bytes) {
+    SpinLock(&Throttle->Lock);
+    u64 Now = Nanoseconds();
+    u64 Delay = MAX(BucketDelay(&Throttle->Operations, Now), BucketDelay(&Throttle->Bytes, Now));
+    if (!Delay) {
+        if (Throttle->Operations.Rate > 0) Throttle->Operations.Tokens -= (double)Operations;
+        if (Throttle->Bytes.Rate > 0)      Throttle->Bytes.Tokens      -= (double)Bytes;
+    }
+    SpinUnlock(&Throttle->Lock);
+    return Delay;
+}
+
+void ThrottleWait(throttle *Throttle, u64 Operations, u64 Bytes) {
+    if (!Throttle) return;
+    while (u64 Delay = ThrottleDelay(Throttle, Operations, Bytes)) SleepNanoseconds(Delay);
+}
+
+// Formatting ------------------------------------------------------------------------------
+
+#define OUTPUT_BUFFER_SIZE KILOBYTES(64)
+
+struct output_buffer {
+    usize Count;
+    char  Data[OUTPUT_BUFFER_SIZE];
+};
+
+static thread_local output_buffer Output;
+
+void FlushOutput() {
+    if (Output.Count == 0) return;
+    WriteStdout(Output.Data, Output.Count);
+    Output.Count = 0;
+}
+
+static inline INLINE void Put(const char *Data, usize Size) {
+    if (Output.Count + Size > OUTPUT_BUFFER_SIZE) {
+        FlushOutput();
+        if (Size > OUTPUT_BUFFER_SIZE) {
+            WriteStdout((char *)Data, Size);
+            return;
+        }
+    }
+    __builtin_memcpy(Output.Data + Output.Count, Data, Size); // Mostly a few bytes, inlined.
+    Output.Count += Size;
+}
+
+static void PutRepeated(char Char, usize Count) {
+    char Chunk[64];
+    for (usize I = 0; I < sizeof(Chunk); ++I) Chunk[I] = Char;
+    for (; Count > sizeof(Chunk); Count -= sizeof(Chunk)) Put(Chunk, sizeof(Chunk));
+    Put(Chunk, Count);
+}
+
+struct format_spec {
+    bool LeftAlign;
+    bool ZeroPad;
+    bool Plus;
+    bool Space;
+    int  Width;
+    int  Precision; // -1 if none.
+};
+
+// Writes Body padded to the spec's width; Sign ("-", "+", "0x" or "") goes before zeros.
+static usize PutField(format_spec *Spec, const char *Sign, const char *Body, usize BodySize) {
+    usize SignSize = 0;
+    while (Sign[SignSize]) SignSize += 1;
+    usize Size = SignSize + BodySize;
+    if (Spec->Width <= 0 || (usize)Spec->Width <= Size) { // The usual case, nothing to pad.
+        Put(Sign, SignSize);
+        Put(Body, BodySize);
+        return Size;
+    }
+
+    usize Padding = (usize)Spec->Width - Size;
+    if (!Spec->LeftAlign && !Spec->ZeroPad) PutRepeated(' ', Padding);
+    Put(Sign, SignSize);
+    if (!Spec->LeftAlign && Spec->ZeroPad) PutRepeated('0', Padding);
+    Put(Body, BodySize);
+    if (Spec->LeftAlign) PutRepeated(' ', Padding);
+    return Size + Padding;
+}
+
+// Digits of Value, written backwards ending at End.
+static char * FormatDigits(char *End, u64 Value, uint Base, bool Upper) {
+    const char *Digits = Upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do {
+        *--End = Digits[Value % Base];
+        Value /= Base;
+    } while (Value);
+    return End;
+}
+
+static usize PutInteger(format_spec *Spec, format_arg *Arg, char Conversion) {
+    // Like printf(), "%u" of a negative number is its two's complement.
+    bool Unsigned = (Conversion != 'd' && Conversion != 'i');
+    bool Negative = false;
+    u64 Value = 0;
+    if (Arg->Type == format_arg::Signed) {
+        Negative = !Unsigned && Arg->S < 0;
+        Value = Negative ? (u64)0 - (u64)Arg->S : (u64)Arg->S;
+        if (Unsigned && Arg->Size < 8) Value &= ((u64)1 << (8 * Arg->Size)) - 1;
+    } else if (Arg->Type == format_arg::Float) {
+        Negative = !Unsigned && Arg->F < 0;
+        Value = (u64)(Negative ? -Arg->F : Arg->F);
+    } else {
+        Value = Arg->U;
+    }
+
+    char Buffer[32];
+    char *End = Buffer + sizeof(Buffer);
+    char *Start = (Conversion == 'x' || Conversion == 'X') ? FormatDigits(End, Value, 16, Conversion == 'X') : FormatDigits(End, Value, 10, false);
+    if (Spec->Precision == 0 && Value == 0) Start = End;
+    while (Spec->Precision > 0 && End - Start < Spec->Precision && Start > Buffer) *--Start = '0';
+
+    const char *Sign = Negative ? "-" : Spec->Plus ? "+" : Spec->Space ? " " : "";
+    if (Spec->Precision >= 0) Spec->ZeroPad = false;
+    return PutField(Spec, Sign, Start, (usize)(End - Start));
+}
+
+// Fixed notation only, the one used here. Precision drops for values that would not fit
+// 64 bits scaled, and what does not fit unscaled is "inf".
+static usize PutFloat(format_spec *Spec, format_arg *Arg) {
+    double Value = (Arg->Type == format_arg::Float) ? Arg->F : (Arg->Type == format_arg::Signed) ? (double)Arg->S : (double)Arg->U;
+    int Precision = (Spec->Precision < 0) ? 6 : MIN(Spec->Precision, 18);
+    bool Negative = Value < 0;
+    if (Negative) Value = -Value;
+
+    if (Value != Value) return PutField(Spec, "", "nan", 3);
+    if (Value >= 1.8e19) return PutField(Spec, Negative ? "-" : "", "inf", 3);
+
+    u64 Scale = 1;
+    for (int I = 0; I < Precision; ++I) Scale *= 10;
+    while (Precision > 0 && Value * (double)Scale >= 1.8e19) {
+        Precision -= 1;
+        Scale /= 10;
+    }
+
+    char Buffer[64];
+    char *End = Buffer + sizeof(Buffer);
+    // Ties go to even, as printf() does for exactly representable halves like 2.25.
+    double Scaled_ = Value * (double)Scale;
+    u64 Scaled = (u64)Scaled_;
+    double Fraction = Scaled_ - (double)Scaled;
+    if (Fraction > 0.5 || (Fraction == 0.5 && (Scaled & 1))) Scaled += 1;
+    char *Start = End;
+    if (Precision) {
+        Start = FormatDigits(End, Scaled % Scale, 10, false);
+        while (End - Start < Precision) *--Start = '0';
+        *--Start = '.';
+    }
+    Start = FormatDigits(Start, Scaled / Scale, 10, false);
+
+    const char *Sign = Negative ? "-" : Spec->Plus ? "+" : Spec->Space ? " " : "";
+    return PutField(Spec, Sign, Start, (usize)(End - Start));
+}
+
+// The next '%' or the terminator. Most of a format is plain text (colors alone are a few
+// dozen bytes a line), so it goes 16 bytes at a time. Aligned loads never cross into a page
+// past the terminator.
+static const char * FindDirective(const char *C) {
+#if __SSE2__
+    const __m128i Percent = _mm_set1_epi8('%');
+    const __m128i Zero    = _mm_setzero_si128();
+    const char *Block = (const char *)((usize)C & ~(usize)15);
+    uint Skip = (uint)(C - Block);
+    for (;; Block += 16, Skip = 0) {
+        __m128i Bytes = _mm_load_si128((const __m128i *)Block);
+        uint Mask = (uint)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(Bytes, Percent), _mm_cmpeq_epi8(Bytes, Zero)));
+        Mask &= ~0u << Skip;
+        if (Mask) return Block + __builtin_ctz(Mask);
+    }
+#else
+    while (*C && *C != '%') ++C;
+    return C;
+#endif
+}
+
+static s64 ArgInteger(format_arg *Arg) {
+    if (Arg->Type == format_arg::Signed)   return Arg->S;
+    if (Arg->Type == format_arg::Unsigned) return (s64)Arg->U;
+    if (Arg->Type == format_arg::Float)    return (s64)Arg->F;
+    return 0;
+}
+
+int FormatOutput(const char *Format, format_arg *Args, int Count) {
+    usize Written = 0;
+    int Next = 0;
+    format_arg Missing;
+    Missing.Type = format_arg::Unsigned;
+    Missing.Size = 8;
+    Missing.U = 0;
+    auto NextArg = [&]() -> format_arg * { return (Next < Count) ? &Args[Next++] : &Missing; };
+
+    for (const char *C = Format; *C;) {
+        const char *Text = C;
+        C = FindDirective(C);
+        if (C > Text) {
+            Put(Text, (usize)(C - Text));
+            Written += (usize)(C - Text);
+        }
+        if (!*C) break;
+
+        const char *Directive = C++;
+        if (*C == '%') {
+            Put("%", 1);
+            Written += 1;
+            C += 1;
+            continue;
+        }
+
+        format_spec Spec = {};
+        Spec.Precision = -1;
+        for (;; ++C) {
+            if      (*C == '-') Spec.LeftAlign = true;
+            else if (*C == '0') Spec.ZeroPad   = true;
+            else if (*C == '+') Spec.Plus      = true;
+            else if (*C == ' ') Spec.Space     = true;
+            else if (*C != '#') break;
+        }
+        if (*C == '*') {
+            s64 Width = ArgInteger(NextArg());
+            if (Width < 0) Spec.LeftAlign = true, Width = -Width;
+            Spec.Width = (int)Width;
+            C += 1;
+        } else {
+            while (*C >= '0' && *C <= '9') Spec.Width = Spec.Width * 10 + (*C++ - '0');
+        }
+        if (*C == '.') {
+            C += 1;
+            Spec.Precision = 0;
+            if (*C == '*') {
+                s64 Precision = ArgInteger(NextArg());
+                Spec.Precision = (Precision < 0) ? -1 : (int)MIN(Precision, (s64)0x7fffffff);
+                C += 1;
+            } else {
+                while (*C >= '0' && *C <= '9') Spec.Precision = Spec.Precision * 10 + (*C++ - '0');
+            }
+        }
+        while (*C == 'l' || *C == 'h' || *C == 'z' || *C == 'j' || *C == 't' || *C == 'L') C += 1;
+
+        char Conversion = *C;
+        if (Conversion) C += 1;
+        switch (Conversion) {
+            case 'd': case 'i': case 'u': case 'x': case 'X': {
+                Written += PutInteger(&Spec, NextArg(), Conversion);
+            } break;
+
+            case 'f': case 'F': {
+                Written += PutFloat(&Spec, NextArg());
+            } break;
+
+            case 's': {
+                auto Arg = NextArg();
+                const char *String = (Arg->Type == format_arg::String && Arg->Str) ? Arg->Str : "(null)";
+                // With a precision it is mostly FSTR, a sized string, so all of it can be read.
+                usize Size = 0;
+                if (Spec.Precision >= 0) Size = (usize)((char *)FindByte((u8 *)String, (u8 *)String + Spec.Precision, 0) - String);
+                else while (String[Size]) Size += 1;
+                Spec.ZeroPad = false;
+                Written += PutField(&Spec, "", String, Size);
+            } break;
+
+            case 'c': {
+                char Char = (char)ArgInteger(NextArg());
+                Spec.ZeroPad = false;
+                Written += PutField(&Spec, "", &Char, 1);
+            } break;
+
+            case 'p': {
+                auto Arg = NextArg();
+                char Buffer[32];
+                char *End = Buffer + sizeof(Buffer);
+                char *Start = FormatDigits(End, (u64)(usize)Arg->P, 16, false);
+                Written += PutField(&Spec, "0x", Start, (usize)(End - Start));
+            } break;
+
+            default: { // Not ours, leave it as it is.
+                Put(Directive, (usize)(C - Directive));
+                Written += (usize)(C - Directive);
+            } break;
+        }
+    }
+
+    return (int)Written;
+}
+
+// Tracing -------------------------------------------------------------------------------
+
+bool Tracing;
+
+struct trace_track {
+    u32 Track;
+    str Name;
+};
+
+static struct {
+    trace_event *Events;
+    u64 Next;  // Events ever claimed, the ring index is this masked.
+    u64 Start; // Nanoseconds() at TraceStart(): timestamps count from there.
+    array<trace_track> Tracks;
+} Trace;
+
+void TraceStart() {
+    Trace.Events = MallocCount<trace_event>(TRACE_EVENTS);
+    Trace.Next   = 0;
+    Trace.Start  = Nanoseconds();
+    Trace.Tracks = array<trace_track>();
+    Tracing = true;
+}
+
+void TraceName(u32 Track, const char *Name, int Number) {
+    array<char> Text;
+    Copy(Text.PushCount(str::StrSize((char *)Name)), Name, str::StrSize((char *)Name));
+    if (Number >= 0) {
+        char Digits[16];
+        char *Start = FormatDigits(Digits + sizeof(Digits), (u64)Number, 10, false);
+        Text.Push(' ');
+        Copy(Text.PushCount((usize)(Digits + sizeof(Digits) - Start)), Start, (usize)(Digits + sizeof(Digits) - Start));
+    }
+
+    auto New = Trace.Tracks.Push();
+    New->Track = Track;
+    New->Name  = str::Copy(Text.Data, Text.Count);
+    Free(Text.Data);
+}
+
+void TraceSpan(const char *Name, u32 Track, u64 Begin, u64 End, const char *Label, usize LabelSize) {
+    u64 Index = __atomic_fetch_add(&Trace.Next, 1, __ATOMIC_RELAXED);
+    auto Event = &Trace.Events[Index & (TRACE_EVENTS - 1)];
+    Event->Begin = Begin;
+    Event->End   = End;
+    Event->Name  = Name;
+    Event->Track = Track;
+    Event->LabelSize = (u32)MIN(LabelSize, (usize)TRACE_LABEL);
+    if (Label) Copy(Event->Label, Label, Event->LabelSize);
+}
+
+static void JsonText(array<char> *Json, const char *Text) {
+    usize Size = str::StrSize((char *)Text);
+    Copy(Json->PushCount(Size), Text, Size);
+}
+
+static void JsonString(array<char> *Json, const char *Chars, usize Size) {
+    Json->Push('"');
+    for (usize I = 0; I < Size; ++I) {
+        u8 C = (u8)Chars[I];
+        if (C == '"' || C == '\\') {
+            Json->Push('\\');
+            Json->Push((char)C);
+        } else if (C < 0x20) {
+            JsonText(Json, "\\u00");
+            Json->Push("0123456789abcdef"[C >> 4]);
+            Json->Push("0123456789abcdef"[C & 15]);
+        } else {
+            Json->Push((char)C);
+        }
+    }
+    Json->Push('"');
+}
+
+static void JsonNumber(array<char> *Json, u64 Value) {
+    char Digits[24];
+    char *Start = FormatDigits(Digits + sizeof(Digits), Value, 10, false);
+    Copy(Json->PushCount((usize)(Digits + sizeof(Digits) - Start)), Start, (usize)(Digits + sizeof(Digits) - Start));
+}
+
+// Microseconds, with the nanoseconds as decimals.
+static void JsonMicroseconds(array<char> *Json, u64 Nanoseconds) {
+    JsonNumber(Json, Nanoseconds / 1000);
+    Json->Push('.');
+    u64 Fraction = Nanoseconds % 1000;
+    Json->Push((char)('0' + Fraction / 100));
+    Json->Push((char)('0' + Fraction / 10 % 10));
+    Json->Push((char)('0' + Fraction % 10));
+}
+
+bool TraceWrite(str *Path) {
+    u64 Count = MIN(Trace.Next, (u64)TRACE_EVENTS);
+    u64 First = Trace.Next - Count;
+
+    array<char> Json(KILOBYTES(64) + Count * 128);
+    JsonText(&Json, "{\"traceEvents\":[\n");
+    bool Comma = false;
+    foreach(Trace.Tracks) {
+        if (Comma) JsonText(&Json, ",\n");
+        Comma = true;
+        JsonText(&Json, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+        JsonNumber(&Json, It->Track);
+        JsonText(&Json, ",\"args\":{\"name\":");
+        JsonString(&Json, It->Name.Chars, It->Name.Size);
+        JsonText(&Json, "}},\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+        JsonNumber(&Json, It->Track);
+        JsonText(&Json, ",\"args\":{\"sort_index\":");
+        JsonNumber(&Json, It->Track);
+        JsonText(&Json, "}}");
+    }
+
+    for (u64 I = First; I < Trace.Next; ++I) {
+        auto Event = &Trace.Events[I & (TRACE_EVENTS - 1)];
+        if (Comma) JsonText(&Json, ",\n");
+        Comma = true;
+        JsonText(&Json, "{\"name\":");
+        JsonString(&Json, Event->Name, str::StrSize((char *)Event->Name));
+        JsonText(&Json, ",\"ph\":\"X\",\"pid\":1,\"tid\":");
+        JsonNumber(&Json, Event->Track);
+        JsonText(&Json, ",\"ts\":");
+        JsonMicroseconds(&Json, (Event->Begin > Trace.Start) ? Event->Begin - Trace.Start : 0);
+        JsonText(&Json, ",\"dur\":");
+        JsonMicroseconds(&Json, (Event->End > Event->Begin) ? Event->End - Event->Begin : 0);
+        if (Event->LabelSize) {
+            JsonText(&Json, ",\"args\":{\"entry\":");
+            JsonString(&Json, Event->Label, Event->LabelSize);
+            Json.Push('}');
+        }
+        Json.Push('}');
+    }
+
+    JsonText(&Json, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":");
+    JsonNumber(&Json, First);
+    JsonText(&Json, "}}\n");
+
+    bool Result = SaveFile(Path, Json.Data, Json.Count);
+    Free(Json.Data);
+    return Result;
+}
+
+// Allocation profiler --------------------------------------------------------------------
+
+#if DEBUG_ALLOCATIONS
+
+// Call sites live in a fixed open-addressing table, claimed with a compare-and-swap on the
+// key, so allocating from any thread never takes a lock or allocates itself. The claiming
+// thread names the site after that, and Ready says when it has.
+#define ALLOCATION_SITES 4096 // Power of two.
+#define ALLOCATION_MAGIC 0x64657461636f6c6cllu
+
+struct allocation_site {
+    u64   Key;      // 0 for a free entry.
+    char *Function;
+    char *File;
+    int   Line;
+    bool  Ready;    // Function, File and Line are set.
+    u64   Count;
+    u64   Bytes;
+    s64   Live;     // Bytes.
+    s64   LiveCount;
+    s64   PeakLive;
+};
+
+// In front of every allocation, 32 bytes to keep malloc()'s 16 byte alignment.
+struct allocation_header {
+    u64 Magic;
+    usize Size;
+    allocation_site *Site;
+    u64 Unused;
+};
+
+static allocation_site AllocationSites[ALLOCATION_SITES];
+static allocation_site AllocationOverflow; // When the table is full.
+static s64 AllocationsLive;
+static s64 AllocationsPeak;
+bool AllocationReportAtExit;
+
+static void AtomicMax(s64 *Value, s64 Candidate) {
+    s64 Current = __atomic_load_n(Value, __ATOMIC_RELAXED);
+    while (Candidate > Current && !__atomic_compare_exchange_n(Value, &Current, Candidate, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+static allocation_site * FindAllocationSite(char *Function, char *File, int Line) {
+    u64 Key = ((u64)(usize)Function * XXH_PRIME1) ^ ((u64)Line * XXH_PRIME2);
+    if (Key == 0) Key = 1;
+
+    for (usize I = 0, Slot = (usize)(Key >> 32); I < ALLOCATION_SITES; ++I, ++Slot) {
+        auto Site = &AllocationSites[Slot & (ALLOCATION_SITES - 1)];
+        u64 Existing = __atomic_load_n(&Site->Key, __ATOMIC_ACQUIRE);
+        if (Existing == Key) return Site;
+        if (Existing == 0) {
+            if (__atomic_compare_exchange_n(&Site->Key, &Existing, Key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                Site->Function = Function;
+                Site->File     = File;
+                Site->Line     = Line;
+                __atomic_store_n(&Site->Ready, true, __ATOMIC_RELEASE);
+                return Site;
+            }
+            if (Existing == Key) return Site;
+        }
+    }
+    return &AllocationOverflow;
+}
+
+static void CountAllocation(allocation_site *Site, s64 Size) {
+    if (Size > 0) {
+        __atomic_add_fetch(&Site->Count, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&Site->Bytes, (u64)Size, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&Site->LiveCount, (Size > 0) ? 1 : -1, __ATOMIC_RELAXED);
+    AtomicMax(&Site->PeakLive, __atomic_add_fetch(&Site->Live, Size, __ATOMIC_RELAXED));
+    AtomicMax(&AllocationsPeak, __atomic_add_fetch(&AllocationsLive, Size, __ATOMIC_RELAXED));
+}
+
+void * allocate_debug(usize data_size, char *function, char *file, int line) {
+    auto Header = (allocation_header *)malloc(sizeof(allocation_header) + data_size);
+    if (!Header) return NULL;
+    Header->Magic = ALLOCATION_MAGIC;
+    Header->Size  = data_size;
+    Header->Site  = FindAllocationSite(function, file, line);
+    CountAllocation(Header->Site, (s64)data_size);
+    return Header + 1;
+}
+
+bool allocation_validate(void *allocation) {
+    if (!allocation) return false;
+    return ((allocation_header *)allocation - 1)->Magic == ALLOCATION_MAGIC;
+}
+
+void deallocate_debug(void *allocation) {
+    if (!allocation) return;
+    assert0(allocation_validate(allocation)); // Not ours, or freed twice.
+    auto Header = (allocation_header *)allocation - 1;
+    CountAllocation(Header->Site, -(s64)Header->Size);
+    Header->Magic = 0;
+    free(Header);
+}
+
+void * reallocate_debug(void *original, usize new_data_size, char *function, char *file, int line) {
+    auto Result = allocate_debug(new_data_size, function, file, line);
+    if (original && Result) {
+        Copy(Result, original, MIN(new_data_size, ((allocation_header *)original - 1)->Size));
+    }
+    deallocate_debug(original);
+    return Result;
+}
+
+void allocation_report() {
+    static allocation_site *Sites[ALLOCATION_SITES + 1];
+    usize Count = 0;
+    s64 Leaked = 0, LeakedCount = 0;
+    for (usize I = 0; I <= ALLOCATION_SITES; ++I) {
+        auto Site = (I < ALLOCATION_SITES) ? &AllocationSites[I] : &AllocationOverflow;
+        if (!Site->Count) continue;
+        Sites[Count++] = Site;
+        Leaked      += Site->Live;
+        LeakedCount += Site->LiveCount;
+    }
+    Sort(Sites, Count, [](allocation_site *A, allocation_site *B) { return A->Bytes > B->Bytes; });
+
+    Printf("\n" c_default "Allocations" c_grey " (peak " c_default FS64 c_grey " bytes live, "
+           c_default FS64 c_grey " bytes in " c_default FS64 c_grey " blocks not freed):\n",
+           AllocationsPeak, Leaked, LeakedCount);
+    Printf(c_grey "%12s %14s %12s %12s  %s" c_default "\n", "count", "bytes", "peak live", "not freed", "call site");
+    for (usize I = 0; I < Count; ++I) {
+        auto Site = Sites[I];
+        bool Named = __atomic_load_n(&Site->Ready, __ATOMIC_ACQUIRE); // Not yet, if just claimed.
+        Printf("%12" PRIu64 " %14" PRIu64 " %12" PRId64 " %12" PRId64 "  " c_cyan "%s" c_grey, Site->Count, Site->Bytes,
+               Site->PeakLive, Site->Live, Named ? Site->Function : (Site == &AllocationOverflow) ? "(table full)" : "(unnamed)");
+        if (Named && Site->File) Printf(" %s:%d", Site->File, Site->Line);
+        Printf(c_default "\n");
+    }
+}
+
+#endif
+
 // ---------------------------------------------------------------------------------------
 
 void
@@ -131,6 +826,20 @@ bool Equal(void *A, void *B, usize Size) {
     return true;
 }
 
+u8 * FindByte(u8 *Data, u8 *End, u8 Byte) {
+#if __SSE2__
+    __m128i Needle = _mm_set1_epi8((char)Byte);
+    for (; Data + 16 <= End; Data += 16) {
+        int Mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)Data), Needle));
+        if (Mask) return Data + __builtin_ctz((uint)Mask);
+    }
+#endif
+    for (; Data < End; ++Data) {
+        if (*Data == Byte) return Data;
+    }
+    return End;
+}
+
 // str ----------------------------------------------------------------------------------
 
 str str::Substring(usize Size) {
@@ -236,6 +945,27 @@ bool str::Contains(char Char) {
     return false;
 }
 
+int str::Compare(str Str) {
+    usize Size = MIN(this->Size, Str.Size);
+    for (usize I = 0; I < Size; ++I) {
+        if (this->Chars[I] != Str.Chars[I]) return (u8)this->Chars[I] < (u8)Str.Chars[I] ? -1 : 1;
+    }
+    if (this->Size == Str.Size) return 0;
+    return this->Size < Str.Size ? -1 : 1;
+}
+
+bool str::ParseU64(u64 *Result) {
+    if (this->Size == 0) return false;
+    u64 Value = 0;
+    for (usize I = 0; I < this->Size; ++I) {
+        char C = this->Chars[I];
+        if (C < '0' || C > '9') return false;
+        Value = Value * 10 + (u64)(C - '0');
+    }
+    *Result = Value;
+    return true;
+}
+
 // ??? ----------------------------------------------------------------------------------
 
 
@@ -103,9 +103,9 @@ typedef u64 usize;
 //------------------------------------------------------------------------------
 
 #if DEBUG_PRINT
-#define  Debug_Info(format, ...) printf(c_grey   "[I] "        format c_default "\n", ##__VA_ARGS__)
-#define Debug_Error(format, ...) printf(c_red    "[E] " c_grey format c_default "\n", ##__VA_ARGS__)
-#define  Debug_Warn(format, ...) printf(c_yellow "[W] " c_grey format c_default "\n", ##__VA_ARGS__)
+#define  Debug_Info(format, ...) Printf(c_grey   "[I] "        format c_default "\n", ##__VA_ARGS__)
+#define Debug_Error(format, ...) Printf(c_red    "[E] " c_grey format c_default "\n", ##__VA_ARGS__)
+#define  Debug_Warn(format, ...) Printf(c_yellow "[W] " c_grey format c_default "\n", ##__VA_ARGS__)
 #else
 #define  Debug_Info(format, ...) (void)0
 #define Debug_Error(format, ...) (void)0
@@ -125,7 +125,20 @@ void assert_(bool expr, char *expr_as_string, char *filename, char *line_number,
 
 //------------------------------------------------------------------------------
 
+// The function an allocation is made from, passed down as a defaulted argument so helpers
+// that allocate (MallocCount(), array growth) charge their caller rather than themselves.
+// (It has to be a constructor's default argument: GCC does not see through call_site{...}.)
+struct call_site {
+    char *Function;
+    explicit call_site(char *Caller = (char*)__builtin_FUNCTION()) {
+        this->Function = Caller;
+    }
+};
+#define CALL_SITE call_site()
+
 #if DEBUG_ALLOCATIONS
+// With DEBUG_ALLOCATIONS, Malloc()/Free() go through these too, and count, per call site,
+// allocations, bytes, peak live bytes and what is still live (leaked) at exit.
 void * reallocate_debug(void *original, usize new_data_size, char *function, char *file, int line);
 void deallocate_debug(void *allocation);
 void * allocate_debug(usize data_size, char *function, char *file, int line);
@@ -133,6 +146,8 @@ void * allocate_debug(usize data_size, char *function, char *file, int line);
 #define       reallocate(original, new_size) reallocate_debug(original, new_size, (char*)__FUNCTION__, __FILE__, __LINE__)
 #define       deallocate(allocation)         deallocate_debug(allocation)
 bool allocation_validate(void *allocation);
+void allocation_report(); // Table of call sites by bytes allocated.
+extern bool AllocationReportAtExit; // "--alloc-report"
 #else
 #define allocate(size)                 malloc(size)
 #define reallocate(original, new_size) realloc(original, new_size)
@@ -200,18 +215,18 @@ struct array {
     usize Capacity;
     usize Count;
 
-    array();
-    array(usize Capacity);
-    void Reserve(usize);
-    T * Push();
-    T * Push(T *);
-    T * Push(const T &);
+    array(call_site Site = CALL_SITE);
+    array(usize Capacity, call_site Site = CALL_SITE);
+    void Reserve(usize, call_site Site = CALL_SITE);
+    T * Push(call_site Site = CALL_SITE);
+    T * Push(T *, call_site Site = CALL_SITE);
+    T * Push(const T &, call_site Site = CALL_SITE);
     void Reset() {
         this->Count = 0;
     }
-    T * PushCount(usize Count) {
+    T * PushCount(usize Count, call_site Site = CALL_SITE) {
         auto NewCount = this->Count + Count;
-        this->Reserve(NewCount);
+        this->Reserve(NewCount, Site);
 
         auto Result = &this->Data[this->Count];
         this->Count = NewCount;
@@ -244,7 +259,43 @@ struct array {
 
 char * format_size(usize size);
 char * FormatNanoseconds(u64 time);
-template <typename T> T * MallocCount(usize Count);
+template <typename T> T * MallocCount(usize Count, call_site Site = CALL_SITE);
+template <typename T, typename L> void Sort(T *Data, usize Count, L Less); // Not stable.
+u64 Hash64(const void *Data, usize Size, u64 Seed = 0); // XXH64, stable across machines (little endian).
+u8 * FindByte(u8 *Data, u8 *End, u8 Byte); // First Byte in [Data, End), End if none. 16 at a time with SSE2.
+
+// For a handful of instructions on state shared between threads.
+static inline void SpinLock(int *Lock) {
+    while (__atomic_exchange_n(Lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(Lock, __ATOMIC_RELAXED)) __builtin_ia32_pause();
+    }
+}
+
+static inline void SpinUnlock(int *Lock) {
+    __atomic_store_n(Lock, 0, __ATOMIC_RELEASE);
+}
+
+//------------------------------------------------------------------------------
+
+// Token buckets pacing operations (commands started, directory entries read, files
+// removed) and bytes. A request larger than the bucket is let through and paid back
+// before the next one, so the average rate holds.
+struct token_bucket {
+    double Rate;   // Per second, 0 for no limit.
+    double Burst;
+    double Tokens;
+    u64    Last;   // Nanoseconds() of the last refill.
+};
+
+struct throttle {
+    token_bucket Operations;
+    token_bucket Bytes;
+    int Lock; // Threads share one.
+};
+
+void ThrottleInit(throttle *Throttle, double OperationsPerSecond, double BytesPerSecond);
+u64  ThrottleDelay(throttle *Throttle, u64 Operations, u64 Bytes); // 0 if taken, else nanoseconds to wait (nothing taken). Thread-safe.
+void ThrottleWait(throttle *Throttle, u64 Operations, u64 Bytes);  // Sleeps until taken. Throttle may be NULL.
 
 //------------------------------------------------------------------------------
 
@@ -314,11 +365,82 @@ struct str {
     bool EndsWith(char Char);
     str Cat(char Char);
     bool Contains(char Char);
+    bool ParseU64(u64 *Result);
+    int Compare(str Str); // Byte order: <0, 0, >0.
 
     static str Copy(char *Chars, usize Size);
 };
 
 
+//------------------------------------------------------------------------------
+
+// Formatting ----------------------------------------------------------------------------
+
+// printf() for the formats used here (%s %d %i %u %x %c %f %p with flags, width and
+// precision, "*" for either as in FSTR; length modifiers are accepted and not needed).
+// No va_list and no locale: an overload picked at compile time turns every argument into
+// a format_arg, so an int passed for "%llu" still prints right. The text goes into a buffer
+// of the calling thread, written out when full or by FlushOutput().
+struct format_arg {
+    enum { Signed, Unsigned, Float, String, Pointer } Type;
+    u8 Size; // Of the argument's own type, for "%u" of a negative int.
+    union {
+        s64 S;
+        u64 U;
+        double F;
+        const char *Str;
+        const void *P;
+    };
+};
+
+inline format_arg FormatArg(int Value)                { format_arg A; A.Type = format_arg::Signed;   A.Size = sizeof(Value); A.S = Value; return A; }
+inline format_arg FormatArg(long Value)               { format_arg A; A.Type = format_arg::Signed;   A.Size = sizeof(Value); A.S = Value; return A; }
+inline format_arg FormatArg(long long Value)          { format_arg A; A.Type = format_arg::Signed;   A.Size = sizeof(Value); A.S = Value; return A; }
+inline format_arg FormatArg(unsigned Value)           { format_arg A; A.Type = format_arg::Unsigned; A.Size = sizeof(Value); A.U = Value; return A; }
+inline format_arg FormatArg(unsigned long Value)      { format_arg A; A.Type = format_arg::Unsigned; A.Size = sizeof(Value); A.U = Value; return A; }
+inline format_arg FormatArg(unsigned long long Value) { format_arg A; A.Type = format_arg::Unsigned; A.Size = sizeof(Value); A.U = Value; return A; }
+inline format_arg FormatArg(double Value)             { format_arg A; A.Type = format_arg::Float;    A.Size = sizeof(Value); A.F = Value; return A; }
+inline format_arg FormatArg(const char *Value)        { format_arg A; A.Type = format_arg::String;   A.Size = sizeof(Value); A.Str = Value; return A; }
+inline format_arg FormatArg(const void *Value)        { format_arg A; A.Type = format_arg::Pointer;  A.Size = sizeof(Value); A.P = Value; return A; }
+
+int FormatOutput(const char *Format, format_arg *Args, int Count); // Bytes formatted.
+void FlushOutput(); // Before starting a child, before blocking, on exit.
+
+template <typename... T>
+int Print(const char *Format, T... Args) {
+    format_arg Packed[sizeof...(T) + 1] = {FormatArg(Args)...};
+    return FormatOutput(Format, Packed, (int)sizeof...(T));
+}
+
+// Never called: Printf() passes its arguments to it inside sizeof() so the compiler still
+// checks them against the format.
+PRINTFLIKE(1,2) int FormatCheck(const char *Format, ...);
+#define Printf(Format, ...) ((void)sizeof(FormatCheck(Format, ##__VA_ARGS__)), Print(Format, ##__VA_ARGS__))
+
+// Tracing ("--trace") ---------------------------------------------------------------------
+
+// Spans (a begin and an end time) on numbered tracks, kept in a ring allocated up front:
+// any thread claims the next event with one atomic add, and once full the oldest go.
+// Written out at the end as Chrome Trace Event JSON (chrome://tracing, ui.perfetto.dev).
+#define TRACE_EVENTS (1 << 17) // Power of two.
+#define TRACE_LABEL  48        // Bytes of the label kept, the rest is cut.
+
+struct trace_event {
+    u64 Begin; // Nanoseconds().
+    u64 End;
+    const char *Name; // Static.
+    u32 Track;
+    u32 LabelSize;
+    char Label[TRACE_LABEL];
+};
+
+extern bool Tracing; // Checked before taking the time for a span, so it costs nothing off.
+
+void TraceStart();
+void TraceName(u32 Track, const char *Name, int Number = -1); // "Name Number". From one thread, before its events.
+void TraceSpan(const char *Name, u32 Track, u64 Begin, u64 End, const char *Label = NULL, usize LabelSize = 0);
+bool TraceWrite(struct str *Path); // False if it cannot be written.
+
 //------------------------------------------------------------------------------
 
 #endif
\ No newline at end of file
@@ -4,6 +4,8 @@
 
 #if (MACINTOSH_X64)
     #include "platform_macos_x64.cpp"
+#elif (LINUX_X64)
+    #include "platform_linux_x64.cpp"
 #elif (WIN_X64)
     #include "platform_windows_x64.cpp"
 #endif
@@ -12,7 +14,11 @@ enum token_type {
     token_NAME,
     token_COLON,
     token_TEXT,
-    token_NEW_COMMAND
+    token_NEW_COMMAND,
+    token_STDIN, // Not an argument: the entry's content goes to standard input.
+    token_OFFSET,
+    token_LENGTH,
+    token_CHUNK
 };
 struct command_token {
     token_type Type;
@@ -29,6 +35,13 @@ array<command_token> TokenizeCommands(slice<str> Commands) {
             Exit(0);
         }
 
+        if (It->Equal(str(":stdin"))) {
+            auto StdinToken = Tokens.Push();
+            StdinToken->Type = token_STDIN;
+            StdinToken->Str  = str();
+            continue;
+        }
+
         auto NewCommandToken = Tokens.Push();
         NewCommandToken->Type = token_NEW_COMMAND;
 
@@ -49,28 +62,2056 @@ array<command_token> TokenizeCommands(slice<str> Commands) {
                     } else if (C.StartsWith(":name")) {
                         Token.Type = token_NAME;
                         Token.Str  = C.Substring(5);
+                    } else if (C.StartsWith(":offset")) {
+                        Token.Type = token_OFFSET;
+                        Token.Str  = C.Substring(7);
+                    } else if (C.StartsWith(":length")) {
+                        Token.Type = token_LENGTH;
+                        Token.Str  = C.Substring(7);
+                    } else if (C.StartsWith(":chunk")) {
+                        Token.Type = token_CHUNK;
+                        Token.Str  = C.Substring(6);
                     } else {
                         if (C.Size == 1) break;
 
-                        C.Size  -= 1;
-                        C.Chars += 1;
-                        Token.Type = token_TEXT;
-                        Token.Str  = str::Until(C, ':');
+                        C.Size  -= 1;
+                        C.Chars += 1;
+                        Token.Type = token_TEXT;
+                        Token.Str  = str::Until(C, ':');
+
+                        Printf(c_dim_red "[E]" c_grey " Unexpected token: " c_dim_yellow ":" FSTR c_grey c_default "\n", (int)Token.Str.Size, Token.Str.Chars);
+                        Exit(0);
+                    }
+                }
+            }
+
+            C.Chars += Token.Str.Size;
+            C.Size  -= Token.Str.Size;
+
+            Tokens.Push(Token);
+        }
+    }
+
+    return Tokens;
+}
+
+bool HasToken(array<command_token> *Tokens, token_type Type) {
+    foreach(*Tokens) if (It->Type == Type) return true;
+    return false;
+}
+
+void Append(array<char> *Buffer, str Str) {
+    Copy(Buffer->PushCount(Str.Size), Str.Chars, Str.Size);
+}
+
+void AppendNumber(array<char> *Buffer, u64 Number) {
+    char Digits[24];
+    int Size = snprintf(Digits, sizeof(Digits), FU64, Number);
+    Append(Buffer, str(Digits, (usize)Size));
+}
+
+// Expands Tokens for one entry into Args, one zero-terminated str per argument. Buffers
+// hold their characters and are reused from entry to entry, so after the first few
+// entries this does not allocate.
+void ExpandCommand(array<command_token> *Tokens, file *File, array<array<char>> *Buffers, array<str> *Args) {
+    Args->Reset();
+    array<char> *Buffer = NULL;
+    usize Used = 0;
+
+    foreach(*Tokens) {
+        switch (It->Type) {
+            case token_NEW_COMMAND: {
+                if (Buffer) Buffer->Push('\0');
+                if (Used == Buffers->Count) *Buffers->Push() = array<char>(64);
+                Buffer = &Buffers->Data[Used++];
+                Buffer->Reset();
+            } break;
+
+            case token_NAME: {
+                Append(Buffer, File->Name);
+            } break;
+
+            case token_COLON: {
+                Buffer->Push(':');
+            } break;
+
+            case token_TEXT: {
+                Append(Buffer, It->Str);
+            } break;
+
+            case token_OFFSET: {
+                AppendNumber(Buffer, File->Offset);
+            } break;
+
+            case token_LENGTH: {
+                AppendNumber(Buffer, (u64)File->Size);
+            } break;
+
+            case token_CHUNK: {
+                AppendNumber(Buffer, (u64)File->Chunk);
+            } break;
+
+            case token_STDIN: break;
+        }
+    }
+    if (Buffer) Buffer->Push('\0');
+
+    for (usize I = 0; I < Used; ++I) {
+        auto Arg = &Buffers->Data[I];
+        Args->Push(str(Arg->Data, Arg->Count - 1));
+    }
+}
+
+// "program arg1 "arg 2"" for echoing (and for CreateProcess on Windows).
+void BuildCommandString(array<char> *CommandString, str *Program, array<str> *Args) {
+    CommandString->Reset();
+    Append(CommandString, *Program);
+    foreach(*Args) {
+        CommandString->Push(' ');
+        bool NeedsQuotes = It->Contains(' ');
+        if (NeedsQuotes) CommandString->Push('"');
+        Append(CommandString, *It);
+        if (NeedsQuotes) CommandString->Push('"');
+    }
+    CommandString->Push('\0');
+}
+
+// Adaptive concurrency ("-j auto") -------------------------------------------------------
+
+// The job limit grows by one every sample while all slots are busy and nothing is under
+// pressure, and is halved (at most once per cooldown) when something is.
+#define PRESSURE_SAMPLE_INTERVAL   1000000000llu // 1s
+#define PRESSURE_DECREASE_COOLDOWN 3000000000llu // 3s, "avg10" needs time to react.
+#define PRESSURE_CPU_LIMIT         25.0f         // % of time some task was stalled.
+#define PRESSURE_MEMORY_LIMIT      10.0f
+#define PRESSURE_IO_LIMIT          30.0f
+#define LOAD_PER_CPU_LIMIT         1.5f          // Only used without CPU pressure information.
+
+struct concurrency {
+    bool Auto;
+    uint Limit;
+    uint Min;
+    uint Max;
+    u64  MemoryReserve; // New children are held while less memory than this is available.
+    bool MemoryHold;
+    u64  NextSample;
+    u64  LastDecrease;
+};
+
+void UpdateConcurrency(concurrency *Concurrency, uint Running, u64 Now) {
+    if (Now < Concurrency->NextSample) return;
+    Concurrency->NextSample = Now + PRESSURE_SAMPLE_INTERVAL;
+
+    system_pressure Pressure;
+    SampleSystemPressure(&Pressure);
+
+    bool WasHeld = Concurrency->MemoryHold;
+    Concurrency->MemoryHold = Concurrency->MemoryReserve && Pressure.MemoryAvailable
+                           && Pressure.MemoryAvailable < Concurrency->MemoryReserve;
+    if (Concurrency->MemoryHold && !WasHeld) {
+        Printf(c_yellow "[W]" c_grey " Only " FU64 " MB of memory available, holding new commands..." c_default "\n",
+            (u64)(Pressure.MemoryAvailable / MEGABYTES(1)));
+    }
+
+    if (!Concurrency->Auto) return;
+
+    char *Reason = NULL;
+    if (Concurrency->MemoryHold)                         Reason = "low memory";
+    else if (Pressure.Memory > PRESSURE_MEMORY_LIMIT)    Reason = "memory pressure";
+    else if (Pressure.Io     > PRESSURE_IO_LIMIT)        Reason = "io pressure";
+    else if (Pressure.Cpu    > PRESSURE_CPU_LIMIT)       Reason = "cpu pressure";
+    else if (Pressure.Cpu < 0 && Pressure.LoadAverage > LOAD_PER_CPU_LIMIT * CpuCount()) Reason = "load average";
+
+    uint Limit = Concurrency->Limit;
+    if (Reason) {
+        if (Now - Concurrency->LastDecrease >= PRESSURE_DECREASE_COOLDOWN) {
+            Limit = MAX(Concurrency->Min, Limit / 2);
+            Concurrency->LastDecrease = Now;
+        }
+    } else if (Running >= Limit) {
+        Limit = MIN(Concurrency->Max, Limit + 1);
+        Reason = "idle";
+    }
+
+    if (Limit != Concurrency->Limit) {
+        Debug_Info("jobs %u -> %u (%s)", Concurrency->Limit, Limit, Reason);
+        Concurrency->Limit = Limit;
+    }
+}
+
+// Sharding ("--shard i/N") --------------------------------------------------------------
+
+struct shard {
+    u64  Index; // 0-based.
+    u64  Count;
+    bool BySize;
+};
+
+// Maps a hash onto [0, Count) without the bias of "%".
+u64 HashToRange(u64 Hash, u64 Count) {
+    return (u64)(((unsigned __int128)Hash * Count) >> 64);
+}
+
+// By name, and by which chunk it is: the chunks of a file get spread out too.
+u64 ShardHash(file *File) {
+    return Hash64(File->Name.Chars, File->Name.Size, File->Chunk);
+}
+
+struct shard_entry {
+    file *File;
+    u64   Hash;
+};
+
+// Keeps only the entries of this shard. Every machine listing the same directory computes
+// the same split, whatever order its listing came in.
+void ApplyShard(array<file> *Files, shard *Shard) {
+    if (Shard->Count <= 1) return;
+
+    array<bool> Keep(Files->Count);
+    Keep.PushCount(Files->Count);
+
+    if (!Shard->BySize) {
+        for (usize I = 0; I < Files->Count; ++I) {
+            Keep.Data[I] = HashToRange(ShardHash(&Files->Data[I]), Shard->Count) == Shard->Index;
+        }
+    } else {
+        // Largest first onto the least loaded shard (LPT), in an order all machines agree on.
+        array<shard_entry> Entries(Files->Count);
+        foreach(*Files) {
+            auto Entry = Entries.Push();
+            Entry->File = It;
+            Entry->Hash = ShardHash(It);
+        }
+        Sort(Entries.Data, Entries.Count, [](shard_entry &A, shard_entry &B) -> bool {
+            if (A.File->Size != B.File->Size) return A.File->Size > B.File->Size;
+            if (A.Hash != B.Hash) return A.Hash < B.Hash;
+            return A.File->Name.Compare(B.File->Name) < 0;
+        });
+
+        array<u64> Load(Shard->Count);
+        for (u64 I = 0; I < Shard->Count; ++I) Load.Push((u64)0);
+
+        foreach(Entries) {
+            u64 Lightest = 0;
+            for (u64 I = 1; I < Shard->Count; ++I) {
+                if (Load.Data[I] < Load.Data[Lightest]) Lightest = I;
+            }
+            Load.Data[Lightest] += MAX(It->File->Size, (usize)1); // Directories and empty files still cost a command.
+            Keep.Data[It->File - Files->Data] = (Lightest == Shard->Index);
+        }
+
+        Free(Entries.Data);
+        Free(Load.Data);
+    }
+
+    usize Kept = 0;
+    for (usize I = 0; I < Files->Count; ++I) {
+        if (Keep.Data[I]) Files->Data[Kept++] = Files->Data[I];
+    }
+    Files->Count = Kept;
+
+    Free(Keep.Data);
+}
+
+// Threads --------------------------------------------------------------------------------
+
+struct parallel_for {
+    void (*Function)(void *Context, usize Index);
+    void *Context;
+    usize Count;
+    usize Next; // Next index nobody has claimed yet.
+};
+
+void ParallelWorker(void *Work_) {
+    auto Work = (parallel_for *)Work_;
+    for (;;) {
+        usize Index = __atomic_fetch_add(&Work->Next, 1, __ATOMIC_RELAXED);
+        if (Index >= Work->Count) return;
+        Work->Function(Work->Context, Index);
+    }
+}
+
+// Calls Function(Context, I) for every I in [0, Count) from up to CpuCount() threads
+// (this one included), handing out one index at a time.
+void ParallelFor(usize Count, void (*Function)(void *Context, usize Index), void *Context) {
+    parallel_for Work = {};
+    Work.Function = Function;
+    Work.Context  = Context;
+    Work.Count    = Count;
+
+    uint ThreadCount = (uint)MIN((usize)CpuCount(), Count);
+    array<thread> Threads(ThreadCount);
+    for (uint I = 1; I < ThreadCount; ++I) Threads.Push(StartThread(ParallelWorker, &Work));
+    ParallelWorker(&Work);
+    foreach(Threads) JoinThread(*It);
+
+    Free(Threads.Data);
+}
+
+// Content dedup ("--dedup-content") -------------------------------------------------------
+
+struct dedup_entry {
+    file *File;
+    u64   Hash;
+    bool  Hashed;
+};
+
+void HashDedupEntry(void *Entries, usize Index) {
+    auto Entry = ((dedup_entry **)Entries)[Index];
+    mapped_file Map;
+    if (!MapFile(&Entry->File->Name, &Map)) return;
+    Entry->Hash   = Hash64(Map.Data, Map.Size);
+    Entry->Hashed = true;
+    UnmapFile(&Map);
+}
+
+bool SameContent(file *A, file *B) {
+    mapped_file MapA, MapB;
+    if (!MapFile(&A->Name, &MapA)) return false;
+    if (!MapFile(&B->Name, &MapB)) { UnmapFile(&MapA); return false; }
+    bool Result = MapA.Size == MapB.Size && Equal(MapA.Data, MapB.Data, MapA.Size);
+    UnmapFile(&MapA);
+    UnmapFile(&MapB);
+    return Result;
+}
+
+// Keeps one file (the first by name) per distinct content. Only files whose size is
+// shared with another file get hashed, in parallel, and a hash match is confirmed by a
+// byte comparison. With Link the dropped copies are replaced by hard links to the one
+// that is kept.
+void DedupContent(array<file> *Files, bool Link, bool DryRun) {
+    array<dedup_entry> Entries(Files->Count);
+    foreach(*Files) {
+        if (It->Type != file_type::File) continue;
+        auto Entry = Entries.Push();
+        Entry->File   = It;
+        Entry->Hash   = 0;
+        Entry->Hashed = false;
+    }
+
+    Sort(Entries.Data, Entries.Count, [](dedup_entry &A, dedup_entry &B) -> bool {
+        return A.File->Size < B.File->Size;
+    });
+
+    array<dedup_entry *> ToHash;
+    for (usize I = 0; I < Entries.Count; ++I) {
+        auto Size = Entries.Data[I].File->Size;
+        bool Collides = (I > 0 && Entries.Data[I-1].File->Size == Size)
+                     || (I + 1 < Entries.Count && Entries.Data[I+1].File->Size == Size);
+        if (Size == 0) Entries.Data[I].Hashed = true; // All empty files are the same.
+        else if (Collides) ToHash.Push(&Entries.Data[I]);
+    }
+    ParallelFor(ToHash.Count, HashDedupEntry, ToHash.Data);
+
+    Sort(Entries.Data, Entries.Count, [](dedup_entry &A, dedup_entry &B) -> bool {
+        if (A.File->Size != B.File->Size) return A.File->Size < B.File->Size;
+        if (A.Hashed != B.Hashed) return A.Hashed < B.Hashed;
+        if (A.Hash != B.Hash) return A.Hash < B.Hash;
+        return A.File->Name.Compare(B.File->Name) < 0;
+    });
+
+    array<bool> Keep(Files->Count);
+    for (usize I = 0; I < Files->Count; ++I) Keep.Push(true);
+
+    usize Duplicates = 0;
+    u64 DuplicateBytes = 0;
+    dedup_entry *Kept = NULL;
+    foreach(Entries) {
+        bool Same = Kept && It->Hashed && Kept->Hashed
+                 && It->File->Size == Kept->File->Size && It->Hash == Kept->Hash;
+        if (!Same) {
+            Kept = It;
+            continue;
+        }
+
+        if (It->File->Size && !SameContent(Kept->File, It->File)) continue; // 64 bit hash collision.
+
+        if (Link) {
+            Printf(c_grey "Linking \"" c_dim_yellow FSTR c_grey "\" to \"" c_dim_yellow FSTR c_grey "\"..." c_default "\n",
+                (int)It->File->Name.Size, It->File->Name.Chars, (int)Kept->File->Name.Size, Kept->File->Name.Chars);
+            if (!DryRun && !ReplaceWithHardLink(&Kept->File->Name, &It->File->Name)) {
+                Printf(c_dim_red "[E]" c_grey " Failed to link \"" c_dim_yellow FSTR c_grey "\"" c_default "\n",
+                    (int)It->File->Name.Size, It->File->Name.Chars);
+            }
+        }
+
+        Keep.Data[It->File - Files->Data] = false;
+        Duplicates += 1;
+        DuplicateBytes += It->File->Size;
+    }
+
+    if (Duplicates) {
+        Printf(c_grey "Skipping " FU64 " duplicate files (" FU64 " MB)." c_default "\n",
+            (u64)Duplicates, (u64)(DuplicateBytes / MEGABYTES(1)));
+    }
+
+    usize KeptCount = 0;
+    for (usize I = 0; I < Files->Count; ++I) {
+        if (Keep.Data[I]) Files->Data[KeptCount++] = Files->Data[I];
+    }
+    Files->Count = KeptCount;
+
+    Free(Keep.Data);
+    Free(ToHash.Data);
+    Free(Entries.Data);
+}
+
+// Up-to-date check ("--output") ---------------------------------------------------------
+
+// Open-addressing table over a directory listing, so outputs that live next to their
+// inputs are checked without a stat() of their own.
+struct name_index {
+    file *Slots; // Empty slots have no name.
+    usize Mask;
+};
+
+name_index BuildNameIndex(array<file> *Files) {
+    name_index Index;
+    usize Capacity = 16;
+    while (Capacity < Files->Count * 2) Capacity *= 2;
+    Index.Mask  = Capacity - 1;
+    Index.Slots = MallocCount<file>(Capacity);
+    for (usize I = 0; I < Capacity; ++I) Index.Slots[I].Name = str();
+
+    foreach(*Files) {
+        usize Slot = Hash64(It->Name.Chars, It->Name.Size) & Index.Mask;
+        while (Index.Slots[Slot].Name.Chars) Slot = (Slot + 1) & Index.Mask;
+        Index.Slots[Slot] = *It;
+    }
+    return Index;
+}
+
+file * FindName(name_index *Index, str Name) {
+    usize Slot = Hash64(Name.Chars, Name.Size) & Index->Mask;
+    while (Index->Slots[Slot].Name.Chars) {
+        if (Index->Slots[Slot].Name.Equal(Name)) return &Index->Slots[Slot];
+        Slot = (Slot + 1) & Index->Mask;
+    }
+    return NULL;
+}
+
+// True if the output of Entry (expanded from OutputTokens) exists and is not older than
+// it, like make does. Listing is the directory the entries came from, NULL to stat() every
+// output.
+bool IsUpToDate(file *Entry, array<command_token> *OutputTokens, name_index *Listing, array<array<char>> *Buffers, array<str> *Output) {
+    ExpandCommand(OutputTokens, Entry, Buffers, Output);
+    assert0(Output->Count == 1);
+
+    file OutputInfo;
+    file *Found = NULL;
+    if (Listing && !Output->Data[0].Contains('/') && !Output->Data[0].Contains('\\')) {
+        Found = FindName(Listing, Output->Data[0]);
+    } else if (StatFile(&Output->Data[0], &OutputInfo)) {
+        Found = &OutputInfo;
+    }
+
+    return Found && Found->ModifiedTime >= Entry->ModifiedTime;
+}
+
+// Drops the entries that are up to date.
+void SkipUpToDate(array<file> *Files, array<command_token> *OutputTokens, name_index *Listing) {
+    array<array<char>> Buffers;
+    array<str> Output;
+
+    usize Kept = 0;
+    foreach(*Files) {
+        if (!IsUpToDate(It, OutputTokens, Listing, &Buffers, &Output)) Files->Data[Kept++] = *It;
+    }
+
+    if (Kept < Files->Count) {
+        Printf(c_grey "Skipping " FU64 " up to date entries." c_default "\n", (u64)(Files->Count - Kept));
+    }
+    Files->Count = Kept;
+
+    foreach(Buffers) Free(It->Data);
+    Free(Buffers.Data);
+    Free(Output.Data);
+}
+
+// Entry lists ("--from") ------------------------------------------------------------------
+
+// A list of names, NUL or newline separated (whichever comes first decides). A regular file
+// is mapped whole, anything else (a pipe) is read a chunk at a time, so the first entries
+// are handed out as soon as they arrive and memory does not grow with the list.
+#define ENTRY_LIST_CHUNK MEGABYTES(1)
+#define STREAM_BACKLOG_ROUNDS 2
+
+struct entry_list {
+    mapped_file Map;
+    s64   Handle;      // -1 when mapped.
+    u8   *Data;        // The map, or a buffer of Capacity bytes.
+    usize Capacity;
+    usize Start;       // [Start, End) is read but not handed out yet.
+    usize End;
+    bool  AtEnd;       // Nothing more to read past End.
+    bool  Detected;
+    u8    Delimiter;
+};
+
+bool OpenEntryList(str *Path, entry_list *List) {
+    *List = {};
+    List->Handle = -1;
+    if (!Path->Equal(str("-")) && MapFile(Path, &List->Map)) {
+        List->Data  = List->Map.Data;
+        List->End   = List->Map.Size;
+        List->AtEnd = true;
+        return true;
+    }
+
+    List->Handle = OpenInput(Path);
+    if (List->Handle < 0) return false;
+    List->Capacity = ENTRY_LIST_CHUNK;
+    List->Data     = MallocCount<u8>(List->Capacity);
+    return true;
+}
+
+void CloseEntryList(entry_list *List) {
+    if (List->Handle < 0) {
+        UnmapFile(&List->Map);
+    } else {
+        CloseInput(List->Handle);
+        Free(List->Data);
+    }
+}
+
+// Next non-empty name, pointing into the list's memory until the next call.
+bool NextEntryName(entry_list *List, str *Name) {
+    for (;;) {
+        auto Data = List->Data + List->Start;
+        auto End  = List->Data + List->End;
+
+        if (!List->Detected) {
+            bool Nul = FindByte(Data, End, '\0') < End;
+            bool Newline = !Nul && FindByte(Data, End, '\n') < End;
+            List->Detected  = Nul || Newline || List->AtEnd; // A single name if neither.
+            List->Delimiter = Newline ? '\n' : '\0';
+        }
+
+        auto Found = List->Detected ? FindByte(Data, End, List->Delimiter) : End;
+        if (Found < End || (List->AtEnd && Data < End)) {
+            List->Start = (usize)(Found - List->Data) + (Found < End);
+            *Name = str((char *)Data, (usize)(Found - Data));
+            if (List->Delimiter == '\n' && Name->Size && Name->Chars[Name->Size - 1] == '\r') Name->Size -= 1;
+            if (Name->Size == 0) continue;
+            return true;
+        }
+        if (List->AtEnd) return false;
+
+        // Keep the unfinished name and read more after it.
+        usize Left = (usize)(End - Data);
+        memmove(List->Data, Data, Left);
+        List->Start = 0;
+        List->End   = Left;
+        if (Left == List->Capacity) {
+            auto Bigger = MallocCount<u8>(List->Capacity * 2);
+            Copy(Bigger, List->Data, Left);
+            Free(List->Data);
+            List->Data = Bigger;
+            List->Capacity *= 2;
+        }
+
+        s64 Read = ReadInput(List->Handle, List->Data + List->End, List->Capacity - List->End);
+        if (Read <= 0) List->AtEnd = true;
+        else           List->End += (usize)Read;
+    }
+}
+
+// The --cache key of an entry (see CacheKey()), 0s until computed.
+struct cache_key {
+    u64 Hash[2];
+};
+
+// Entries taken from a list own their name (zero-terminated, for the system calls) and
+// are recycled once done with, so only the ones in flight take memory. What file leaves
+// to the options that need it they carry here; entries of a listing have it in arrays of
+// Main's, made only with those options.
+struct listed_entry {
+    file File; // First, so a file * of one is a listed_entry *.
+    array<char> Name;
+    listed_entry *NextFree;
+    cache_key Key; // With --cache.
+    uint Jobs;     // With --jobfile, jobs not done with it yet (set when it is handed out).
+    uint HostFailures; // With --hosts, times a host could not run it (it gets one try per host).
+};
+
+struct entry_pool {
+    listed_entry *FirstFree;
+};
+
+file * TakeEntry(entry_pool *Pool, str Name) {
+    auto Entry = Pool->FirstFree;
+    if (Entry) {
+        Pool->FirstFree = Entry->NextFree;
+    } else {
+        Entry = MallocCount<listed_entry>(1);
+        Entry->Name = array<char>(64);
+    }
+    Entry->Name.Reset();
+    Append(&Entry->Name, Name);
+    Entry->Name.Push('\0');
+
+    Entry->File = {};
+    Entry->File.Name = str(Entry->Name.Data, Name.Size);
+    Entry->Key  = {};
+    Entry->Jobs = 0;
+    Entry->HostFailures = 0;
+    return &Entry->File;
+}
+
+void ReleaseEntry(entry_pool *Pool, file *File) {
+    auto Entry = (listed_entry *)File;
+    Entry->NextFree = Pool->FirstFree;
+    Pool->FirstFree = Entry;
+}
+
+// Archives ("--from-archive") -----------------------------------------------------------
+
+// A tar file (ustar, with GNU long names and pax extended headers) as a list of its members,
+// read a header at a time as entries are needed. It is mapped, so only the pages of headers
+// are read here: content is only read for commands that take it on ":stdin".
+#define TAR_BLOCK 512
+
+struct archive {
+    mapped_file Map;
+    s64   Handle;        // The same file, open for the streams. Left open (and mapped) to the end.
+    str  *Path;
+    usize Next;          // Offset of the next header.
+    array<char> Name;    // For names that are not in the header as they are.
+    bool  HasLongName;   // From a GNU 'L' header or a pax "path" record, for the member after it.
+    bool  HasLongSize;   // From a pax "size" record.
+    u64   LongSize;
+};
+
+struct archive_member {
+    str Name; // Pointing into the archive's memory until the next call.
+    u64 Offset; // Of its content.
+    u64 Size;
+    u64 ModifiedTime;
+    file_type::file_type Type;
+};
+
+bool OpenArchive(str *Path, archive *Archive) {
+    *Archive = {};
+    Archive->Path = Path;
+    if (!MapFile(Path, &Archive->Map)) return false;
+    Archive->Handle = OpenInput(Path);
+    if (Archive->Handle < 0) {
+        UnmapFile(&Archive->Map);
+        return false;
+    }
+    return true;
+}
+
+// Octal, or base-256 (GNU, for sizes of 8 GB and up) when the top bit is set.
+static u64 TarNumber(u8 *Field, usize Size) {
+    u64 Result = 0;
+    if (Field[0] & 0x80) {
+        Result = Field[0] & 0x7f;
+        for (usize I = 1; I < Size; ++I) Result = (Result << 8) | Field[I];
+        return Result;
+    }
+    usize I = 0;
+    while (I < Size && Field[I] == ' ') ++I;
+    for (; I < Size && Field[I] >= '0' && Field[I] <= '7'; ++I) Result = Result * 8 + (u64)(Field[I] - '0');
+    return Result;
+}
+
+static bool TarChecksumMatches(u8 *Header) {
+    u64 Sum = 0;
+    for (usize I = 0; I < TAR_BLOCK; ++I) Sum += (I >= 148 && I < 156) ? ' ' : Header[I]; // The field itself counts as spaces.
+    return Sum == TarNumber(Header + 148, 8);
+}
+
+static str TarField(u8 *Field, usize Size) {
+    return str((char *)Field, (usize)(FindByte(Field, Field + Size, '\0') - Field));
+}
+
+// "LENGTH KEY=VALUE\n" records. Only what says where the next member is and what it is
+// called matters here.
+static void ReadPaxRecords(archive *Archive, u8 *C, u8 *End) {
+    while (C < End) {
+        auto Start = C;
+        u64 Length = 0;
+        while (C < End && *C >= '0' && *C <= '9') Length = Length * 10 + (u64)(*C++ - '0');
+        if (C == End || *C != ' ' || Length <= (u64)(C - Start) + 1 || Length > (u64)(End - Start)) return;
+
+        auto Key = C + 1;
+        auto RecordEnd = Start + Length - 1; // The '\n'.
+        auto Equals = FindByte(Key, RecordEnd, '=');
+        if (Equals == RecordEnd) return;
+        auto Name  = str((char *)Key, (usize)(Equals - Key));
+        auto Value = str((char *)Equals + 1, (usize)(RecordEnd - Equals - 1));
+        if (Name.Equal(str("path"))) {
+            Archive->Name.Reset();
+            Append(&Archive->Name, Value);
+            Archive->HasLongName = true;
+        } else if (Name.Equal(str("size"))) {
+            Archive->HasLongSize = Value.ParseU64(&Archive->LongSize);
+        }
+        C = RecordEnd + 1;
+    }
+}
+
+// Files and directories only: links, devices and the like are passed over.
+bool NextArchiveMember(archive *Archive, archive_member *Member) {
+    auto Data = Archive->Map.Data;
+    usize Size = Archive->Map.Size;
+
+    while (Archive->Next < Size) {
+        auto Header = Data + Archive->Next;
+        if (Size - Archive->Next < TAR_BLOCK) {
+            Printf(c_yellow "[W]" c_grey " \"" c_dim_yellow FSTR c_grey "\" is cut short at byte " FU64 ", ignoring the rest." c_default "\n",
+                (int)Archive->Path->Size, Archive->Path->Chars, (u64)Archive->Next);
+            break;
+        }
+        bool Zeros = true;
+        for (usize I = 0; I < TAR_BLOCK && Zeros; ++I) Zeros = !Header[I];
+        if (Zeros) break; // The end of the archive.
+        if (!TarChecksumMatches(Header)) {
+            Printf(c_yellow "[W]" c_grey " \"" c_dim_yellow FSTR c_grey "\" is not a tar archive from byte " FU64 " on, ignoring the rest." c_default "\n",
+                (int)Archive->Path->Size, Archive->Path->Chars, (u64)Archive->Next);
+            break;
+        }
+
+        char Type = (char)Header[156];
+        bool Extension = Type == 'L' || Type == 'x' || Type == 'g' || Type == 'K';
+        usize Content = Archive->Next + TAR_BLOCK;
+        u64 ContentSize = (Archive->HasLongSize && !Extension) ? Archive->LongSize : TarNumber(Header + 124, 12);
+        if (ContentSize > Size - Content) {
+            Printf(c_yellow "[W]" c_grey " \"" c_dim_yellow FSTR c_grey "\" is cut short at byte " FU64 ", ignoring the rest." c_default "\n",
+                (int)Archive->Path->Size, Archive->Path->Chars, (u64)Archive->Next);
+            break;
+        }
+        Archive->Next = Content + (usize)((ContentSize + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK);
+
+        if (Type == 'L') { // GNU long name: the content, for the next header.
+            Archive->Name.Reset();
+            Append(&Archive->Name, TarField(Data + Content, (usize)ContentSize));
+            Archive->HasLongName = true;
+            continue;
+        } else if (Type == 'x') {
+            ReadPaxRecords(Archive, Data + Content, Data + Content + ContentSize);
+            continue;
+        } else if (Type == 'g' || Type == 'K') { // Global pax records, GNU long link targets.
+            continue;
+        }
+
+        // A header of a member of its own: what came before it was for it.
+        bool HasLongName = Archive->HasLongName;
+        Archive->HasLongName = false;
+        Archive->HasLongSize = false;
+        if (Type != '0' && Type != '\0' && Type != '7' && Type != '5') continue;
+
+        str Name;
+        if (HasLongName) {
+            Name = str(Archive->Name.Data, Archive->Name.Count);
+        } else {
+            Name = TarField(Header, 100);
+            auto Prefix = TarField(Header + 345, 155);
+            bool Ustar = true; // "ustar\0", not GNU's "ustar  ".
+            for (usize I = 0; I < 6; ++I) Ustar &= Header[257 + I] == (u8)"ustar"[I];
+            if (Ustar && Prefix.Size) { // POSIX ustar splits long names in two (GNU uses the room for other things).
+                Archive->Name.Reset();
+                Append(&Archive->Name, Prefix);
+                Archive->Name.Push('/');
+                Append(&Archive->Name, Name);
+                Name = str(Archive->Name.Data, Archive->Name.Count);
+            }
+        }
+        while (Name.Size && Name.Chars[Name.Size - 1] == '/') Name.Size -= 1;
+        if (Name.Size == 0 || Name.Equal(str("."))) continue;
+
+        Member->Name   = Name;
+        Member->Offset = (u64)Content;
+        Member->Size   = (Type == '5') ? 0 : ContentSize;
+        Member->ModifiedTime = TarNumber(Header + 136, 12) * 1000000000llu;
+        Member->Type   = (Type == '5') ? file_type::Directory : file_type::File;
+        return true;
+    }
+
+    Archive->Next = Size;
+    return false;
+}
+
+// Chunks ("--chunks") -------------------------------------------------------------------
+
+// Every regular file of Files bigger than Size becomes entries of about Size bytes each,
+// ending just after a Delimiter (or at the end of the file) so each record is in exactly
+// one of them. The file is mapped, and only the pages from each nominal end on to the next
+// Delimiter are read (FindByte(), 16 bytes at a time).
+array<file> SplitIntoChunks(array<file> *Files, u64 Size, u8 Delimiter) {
+    array<file> Chunks(Files->Count);
+    foreach(*Files) {
+        mapped_file Map;
+        if (It->Type != file_type::File || It->Size <= Size) {
+            Chunks.Push(It);
+            continue;
+        }
+        if (!MapFile(&It->Name, &Map)) {
+            Printf(c_yellow "[W]" c_grey " Cannot map \"" c_dim_yellow FSTR c_grey "\", running on it whole." c_default "\n",
+                (int)It->Name.Size, It->Name.Chars);
+            Chunks.Push(It);
+            continue;
+        }
+
+        auto End = Map.Data + Map.Size;
+        uint Index = 0;
+        for (u64 Start = 0; Start < Map.Size;) {
+            u64 Stop = Map.Size;
+            if (Map.Size - Start > Size) {
+                Stop = (u64)(FindByte(Map.Data + Start + Size - 1, End, Delimiter) - Map.Data);
+                Stop = MIN(Stop + 1, (u64)Map.Size);
+            }
+
+            auto Chunk = Chunks.Push(It);
+            Chunk->Offset = Start;
+            Chunk->Size   = (usize)(Stop - Start);
+            Chunk->Chunk  = Index++;
+            Start = Stop;
+        }
+        UnmapFile(&Map);
+    }
+    return Chunks;
+}
+
+// Inode sets ("--unique-inodes", "--follow-symlinks") ------------------------------------
+
+// (file system, inode) pairs, open addressing with linear probing: 16 bytes a slot, grown
+// to stay at most half full. Inode 0 is never a file's, so (0, 0) marks a free slot.
+struct inode_set {
+    u64 *Slots;     // FileSystem, Inode.
+    usize Capacity; // Slots, a power of 2.
+    usize Count;
+};
+
+static usize InodeSlot(inode_set *Set, u64 FileSystem, u64 Inode) {
+    u64 Hash = (Inode * 0x9E3779B97F4A7C15llu) ^ (FileSystem * 0xC2B2AE3D27D4EB4Fllu);
+    return (usize)(Hash ^ (Hash >> 29)) & (Set->Capacity - 1);
+}
+
+// False if it was there already.
+bool InodeSetInsert(inode_set *Set, u64 FileSystem, u64 Inode) {
+    if (2 * (Set->Count + 1) > Set->Capacity) {
+        inode_set Grown = {};
+        Grown.Capacity = Set->Capacity ? 2 * Set->Capacity : 1024;
+        Grown.Slots = MallocCount<u64>(2 * Grown.Capacity);
+        for (usize I = 0; I < 2 * Grown.Capacity; ++I) Grown.Slots[I] = 0;
+        for (usize I = 0; I < Set->Capacity; ++I) {
+            u64 *Old = &Set->Slots[2 * I];
+            if (Old[1]) InodeSetInsert(&Grown, Old[0], Old[1]);
+        }
+        Free(Set->Slots);
+        *Set = Grown;
+    }
+
+    for (usize I = InodeSlot(Set, FileSystem, Inode);; I = (I + 1) & (Set->Capacity - 1)) {
+        u64 *Slot = &Set->Slots[2 * I];
+        if (Slot[1] == 0) {
+            Slot[0] = FileSystem;
+            Slot[1] = Inode;
+            Set->Count += 1;
+            return true;
+        }
+        if (Slot[0] == FileSystem && Slot[1] == Inode) return false;
+    }
+}
+
+// Directory listings ("--recursive", "--ignore-files") --------------------------------------
+
+// With --ignore-files, the .gitignore and .fefignore (which wins) of every directory listed
+// apply to it and to everything below it, as in git: the last rule that matches decides,
+// a deeper directory's rules before a shallower one's. What is ignored is never listed,
+// and an ignored directory is never opened. ".git" always is.
+//
+// Rules are compiled once per file read, and a directory shares the level of its parent
+// unless it has rule files of its own. Names below the directory listed use "/", on
+// Windows too (which takes it), as patterns do.
+
+namespace ignore_kind {
+enum ignore_kind {
+    Literal, // "node_modules"
+    Suffix,  // "*.o", Pattern is ".o"
+    Glob
+};
+}
+
+struct ignore_rule {
+    str Pattern; // Without "!", a leading "/" and a trailing "/".
+    ignore_kind::ignore_kind Kind;
+    bool Negated;
+    bool DirectoryOnly;
+    bool Anchored; // Had a "/": matched against the path from its file's directory, else against the name.
+};
+
+struct ignore_level {
+    ignore_level *Parent;
+    usize PrefixSize; // Of the relative path of its directory, which names below it start with.
+    array<ignore_rule> Rules;
+    array<char *> Texts; // Of its rule files, Rules point into them.
+};
+
+struct listing_options {
+    bool WithFileInfo;
+    bool Recursive;
+    bool IgnoreFiles;
+    bool FollowSymlinks;
+    bool UniqueInodes; // Walk a directory reached twice (through links) once.
+    throttle *Throttle;
+};
+
+struct tree_walk {
+    listing_options *Options;
+    str Root;                    // Ending in a separator, "" for the working directory.
+    array<char> Path;            // Root and the relative path of the directory being listed.
+    array<ignore_level *> Levels; // All of them, freed at the end.
+    array<file> *Result;
+    array<u64> Ancestors;        // FileSystem, Inode of each directory being walked, following links.
+    inode_set Walked;            // Directories walked, with UniqueInodes.
+};
+
+bool IsTrash(str *Name); // Background removal, below.
+
+// One of "?", "[...]", "\x" or a literal against Char: past it if it matches, NULL if not.
+static char *GlobMatchOne(char *P, char *PEnd, char Char) {
+    if (*P == '?') return (Char != '/') ? P + 1 : NULL;
+    if (*P == '\\' && P + 1 < PEnd) return (P[1] == Char) ? P + 2 : NULL;
+    if (*P == '[') {
+        char *C = P + 1;
+        bool Negated = C < PEnd && (*C == '!' || *C == '^');
+        if (Negated) ++C;
+        bool Matched = false;
+        for (char *First = C; C < PEnd && (*C != ']' || C == First); ++C) {
+            if (C + 2 < PEnd && C[1] == '-' && C[2] != ']') {
+                Matched |= (u8)Char >= (u8)C[0] && (u8)Char <= (u8)C[2];
+                C += 2;
+            } else {
+                Matched |= *C == Char;
+            }
+        }
+        if (C < PEnd) return (Matched != Negated && Char != '/') ? C + 1 : NULL;
+        // No "]": a plain "[".
+    }
+    return (*P == Char) ? P + 1 : NULL;
+}
+
+// "*" and "?" do not match "/", "**" as a whole path component matches any number of them.
+static bool GlobMatch(char *Start, char *P, char *PEnd, char *S, char *SEnd) {
+    char *StarP = NULL;
+    char *StarS = NULL;
+    for (;;) {
+        if (P < PEnd && *P == '*') {
+            bool Component = (P == Start || P[-1] == '/') && P + 1 < PEnd && P[1] == '*' && (P + 2 == PEnd || P[2] == '/');
+            if (Component) {
+                if (P + 2 == PEnd) return true; // "dir/**": everything in it.
+                for (char *T = S;; ++T) {      // "**/": no directory, or any number of them.
+                    if ((T == S || T[-1] == '/') && GlobMatch(Start, P + 3, PEnd, T, SEnd)) return true;
+                    if (T == SEnd) return false;
+                }
+            }
+            while (P < PEnd && *P == '*') ++P;
+            StarP = P;
+            StarS = S;
+            continue;
+        }
+        if (S == SEnd) return P == PEnd;
+
+        char *Next = (P < PEnd) ? GlobMatchOne(P, PEnd, *S) : NULL;
+        if (Next) {
+            P = Next;
+            S += 1;
+        } else if (StarP && *StarS != '/') {
+            // The last "*" takes one more character.
+            P = StarP;
+            S = ++StarS;
+        } else {
+            return false;
+        }
+    }
+}
+
+static bool RuleMatches(ignore_rule *Rule, str Path, str Name, bool IsDirectory) {
+    if (Rule->DirectoryOnly && !IsDirectory) return false;
+    str Subject = Rule->Anchored ? Path : Name;
+    switch (Rule->Kind) {
+        case ignore_kind::Literal: return Subject.Equal(Rule->Pattern);
+        case ignore_kind::Suffix:  return Subject.Size >= Rule->Pattern.Size &&
+                                          str(Subject.Chars + Subject.Size - Rule->Pattern.Size, Rule->Pattern.Size).Equal(Rule->Pattern);
+        case ignore_kind::Glob:    return GlobMatch(Rule->Pattern.Chars, Rule->Pattern.Chars, Rule->Pattern.Chars + Rule->Pattern.Size,
+                                                    Subject.Chars, Subject.Chars + Subject.Size);
+    }
+    return false;
+}
+
+// Relative is the name's path below the directory listed.
+bool IsIgnored(ignore_level *Level, str Relative, str Name, bool IsDirectory) {
+    for (; Level; Level = Level->Parent) {
+        str Path = str(Relative.Chars + Level->PrefixSize, Relative.Size - Level->PrefixSize);
+        for (usize I = Level->Rules.Count; I-- > 0;) {
+            auto Rule = &Level->Rules.Data[I];
+            if (RuleMatches(Rule, Path, Name, IsDirectory)) return !Rule->Negated;
+        }
+    }
+    return false;
+}
+
+static bool HasGlob(char *C, char *End) {
+    for (; C < End; ++C) if (*C == '*' || *C == '?' || *C == '[' || *C == '\\') return true;
+    return false;
+}
+
+// Lines of a .gitignore: blank ones and "#" comments skipped, trailing blanks dropped
+// (unless escaped), "\#" and "\!" for patterns starting with those.
+void CompileIgnoreRules(char *Text, usize Size, array<ignore_rule> *Rules) {
+    char *End = Text + Size;
+    for (char *Line = Text; Line < End;) {
+        char *LineEnd = (char *)FindByte((u8 *)Line, (u8 *)End, '\n');
+        char *C = Line;
+        char *E = LineEnd;
+        Line = LineEnd + 1;
+
+        while (E > C && (E[-1] == '\r' || E[-1] == ' ' || E[-1] == '\t') && !(E - 1 > C && E[-2] == '\\')) --E;
+        if (C == E || *C == '#') continue;
+
+        ignore_rule Rule = {};
+        if (*C == '!') {
+            Rule.Negated = true;
+            ++C;
+        } else if (*C == '\\' && C + 1 < E && (C[1] == '#' || C[1] == '!')) {
+            ++C;
+        }
+        if (E > C && E[-1] == '/') {
+            Rule.DirectoryOnly = true;
+            --E;
+        }
+        for (char *D = C; D < E; ++D) Rule.Anchored |= *D == '/';
+        if (C < E && *C == '/') ++C;
+        if (C == E) continue;
+
+        Rule.Pattern = str(C, (usize)(E - C));
+        if (!HasGlob(C, E)) {
+            Rule.Kind = ignore_kind::Literal;
+        } else if (*C == '*' && !Rule.Anchored && !HasGlob(C + 1, E)) {
+            Rule.Kind = ignore_kind::Suffix;
+            Rule.Pattern = str(C + 1, (usize)(E - C - 1));
+        } else {
+            Rule.Kind = ignore_kind::Glob;
+        }
+        Rules->Push(Rule);
+    }
+}
+
+// The level for a directory just read: Parent, unless it has rule files of its own.
+static ignore_level *LoadIgnoreLevel(tree_walk *Walk, array<file> *Entries, usize PrefixSize, ignore_level *Parent) {
+    static const char *RuleFiles[] = {".gitignore", ".fefignore"};
+
+    ignore_level *Level = Parent;
+    for (uint I = 0; I < sizeof(RuleFiles) / sizeof(*RuleFiles); ++I) {
+        bool Present = false;
+        foreach(*Entries) Present |= It->Type == file_type::File && It->Name.Equal(str((char *)RuleFiles[I]));
+        if (!Present) continue;
+
+        usize Size = Walk->Path.Count;
+        Copy(Walk->Path.PushCount(strlen(RuleFiles[I]) + 1), RuleFiles[I], strlen(RuleFiles[I]) + 1);
+        auto Path = str(Walk->Path.Data, Walk->Path.Count - 1);
+        mapped_file Map;
+        bool Mapped = MapFile(&Path, &Map);
+        Walk->Path.Count = Size;
+        if (!Mapped || Map.Size == 0) {
+            if (Mapped) UnmapFile(&Map);
+            continue;
+        }
+
+        if (Level == Parent) {
+            Level = MallocCount<ignore_level>(1);
+            *Level = {};
+            Level->Parent     = Parent;
+            Level->PrefixSize = PrefixSize;
+            Walk->Levels.Push(Level);
+        }
+        usize TextSize = Map.Size;
+        auto Text = MallocCount<char>(TextSize);
+        Copy(Text, Map.Data, TextSize);
+        UnmapFile(&Map);
+        Level->Texts.Push(Text);
+        CompileIgnoreRules(Text, TextSize, &Level->Rules);
+    }
+    return Level;
+}
+
+// Lists the directory at Walk->Path (Root and Relative) into Walk->Result. When recursive, a
+// directory comes after everything in it, so --del can remove it last.
+static void WalkDirectory(tree_walk *Walk, usize RelativeSize, ignore_level *Level) {
+    Walk->Path.Push('\0');
+    auto Directory = str(Walk->Path.Data, Walk->Path.Count - 1);
+    auto Entries = ReadDirectory(&Directory, Walk->Options->WithFileInfo, Walk->Options->Throttle, Walk->Options->FollowSymlinks);
+    Walk->Path.Count -= 1;
+    if (Walk->Options->IgnoreFiles) Level = LoadIgnoreLevel(Walk, &Entries, RelativeSize, Level);
+
+    usize PathSize = Walk->Path.Count;
+    foreach(Entries) {
+        bool IsDirectory = It->Type == file_type::Directory;
+        Copy(Walk->Path.PushCount(It->Name.Size), It->Name.Chars, It->Name.Size);
+        auto Relative = str(Walk->Path.Data + Walk->Root.Size, Walk->Path.Count - Walk->Root.Size);
+
+        bool Skipped = Walk->Options->IgnoreFiles &&
+                       ((IsDirectory && It->Name.Equal(str((char *)".git"))) || IsIgnored(Level, Relative, It->Name, IsDirectory));
+        bool Descend = Walk->Options->Recursive && IsDirectory && !Skipped && !IsTrash(&It->Name);
+        if (Descend && Walk->Options->FollowSymlinks && It->Inode) {
+            // A link back up would be walked forever.
+            for (usize I = 0; I < Walk->Ancestors.Count && Descend; I += 2) {
+                Descend = !(Walk->Ancestors.Data[I] == It->FileSystem && Walk->Ancestors.Data[I + 1] == It->Inode);
+            }
+            if (!Descend) {
+                Printf(c_yellow "[W]" c_grey " Not following \"" c_dim_yellow FSTR c_grey "\" into a directory it is in." c_default "\n",
+                    (int)Relative.Size, Relative.Chars);
+            }
+        }
+        if (Descend && Walk->Options->UniqueInodes && It->Inode) Descend = InodeSetInsert(&Walk->Walked, It->FileSystem, It->Inode);
+        if (Descend) {
+            Walk->Ancestors.Push(It->FileSystem);
+            Walk->Ancestors.Push(It->Inode);
+            Walk->Path.Push('/');
+            WalkDirectory(Walk, RelativeSize + It->Name.Size + 1, Level);
+            Walk->Path.Count -= 1;
+            Walk->Ancestors.Count -= 2;
+        }
+
+        if (!Skipped && RelativeSize) {
+            Free(It->Name.Chars);
+            It->Name = str::Copy(Walk->Path.Data + Walk->Root.Size, Walk->Path.Count - Walk->Root.Size);
+        }
+        if (Skipped) Free(It->Name.Chars);
+        else         Walk->Result->Push(It);
+        Walk->Path.Count = PathSize;
+    }
+    Free(Entries.Data);
+}
+
+// Like ReadDirectory(), names relative to Directory ("sub/name" when recursive).
+array<file> ListDirectory(str *Directory, listing_options *Options) {
+    if (!Options->Recursive && !Options->IgnoreFiles) {
+        return ReadDirectory(Directory, Options->WithFileInfo, Options->Throttle, Options->FollowSymlinks);
+    }
+
+    array<file> Result;
+    tree_walk Walk = {};
+    Walk.Options = Options;
+    Walk.Root    = *Directory;
+    Walk.Result  = &Result;
+    Copy(Walk.Path.PushCount(Directory->Size), Directory->Chars, Directory->Size);
+    file Root = {};
+    if (Options->FollowSymlinks && StatFile(Directory, &Root, true)) {
+        Walk.Ancestors.Push(Root.FileSystem);
+        Walk.Ancestors.Push(Root.Inode);
+        if (Options->UniqueInodes) InodeSetInsert(&Walk.Walked, Root.FileSystem, Root.Inode);
+    }
+    WalkDirectory(&Walk, 0, NULL);
+
+    foreach(Walk.Levels) {
+        auto Level = *It;
+        foreach(Level->Texts) Free(*It);
+        Free(Level->Texts.Data);
+        Free(Level->Rules.Data);
+        Free(Level);
+    }
+    Free(Walk.Levels.Data);
+    Free(Walk.Path.Data);
+    Free(Walk.Ancestors.Data);
+    Free(Walk.Walked.Slots);
+    return Result;
+}
+
+// --trace tracks: the scheduler (the main thread), one per slot, one per device listed by
+// a thread of its own, one per thread emptying the trash.
+#define TRACK_SCHEDULER     0
+#define TRACK_SLOT(Index)   (1 + (u32)(Index))
+#define TRACK_DEVICE(Index) (100000 + (u32)(Index))
+#define TRACK_TRASH(Index)  (200000 + (u32)(Index))
+
+// Several roots ("--in") -----------------------------------------------------------------
+
+// Roots are grouped by the device they are on. Each device is listed by a thread of its own
+// (its roots one after the other, so a disk is not made to seek between them), and may get
+// a job limit of its own, so one slow disk neither holds up the others nor takes every slot.
+struct device {
+    u64 Id;             // st_dev, or the volume serial number on Windows.
+    uint Index;         // file::Device of its entries.
+    array<str> Roots;   // Ending in a separator.
+    array<file> Listing;
+    listing_options *Options;
+    usize Next;         // Its entries not started yet: Files[Next, End).
+    usize End;
+    usize Prefetched;   // Files[Next, Prefetched) have been prefetched.
+    uint Running;       // Commands running on its entries, any stage.
+};
+
+#if WIN_X64
+    #define PATH_SEPARATOR '\\'
+#else
+    #define PATH_SEPARATOR '/'
+#endif
+
+array<device> GroupRoots(array<str *> *Roots) {
+    array<device> Devices;
+    foreach(*Roots) {
+        auto Root = *It;
+        u64 Id;
+        if (!FileDevice(Root, &Id)) {
+            Printf(c_dim_red "[E]" c_grey " Cannot find \"" c_dim_yellow FSTR c_grey "\"" c_default "\n", (int)Root->Size, Root->Chars);
+            Exit(0);
+        }
+
+        device *Device = NULL;
+        for (usize I = 0; I < Devices.Count; ++I) {
+            if (Devices.Data[I].Id == Id) Device = &Devices.Data[I];
+        }
+        if (!Device) {
+            Device = Devices.Push();
+            *Device = {};
+            Device->Id    = Id;
+            Device->Index = (uint)(Devices.Count - 1);
+        }
+
+        bool Separated = Root->EndsWith('/') || Root->EndsWith('\\');
+        Device->Roots.Push(Separated ? str::Copy(Root->Chars, Root->Size) : Root->Cat(PATH_SEPARATOR));
+    }
+    return Devices;
+}
+
+// Names come out as "root/name".
+void ReadDevice(void *Device_) {
+    auto Device = (device *)Device_;
+    foreach(Device->Roots) {
+        auto Root = It;
+        u64 Begin = Tracing ? Nanoseconds() : 0;
+        auto Entries = ListDirectory(Root, Device->Options);
+        if (Tracing) TraceSpan("read directory", TRACK_DEVICE(Device->Index), Begin, Nanoseconds(), Root->Chars, Root->Size);
+        foreach(Entries) {
+            auto Name = It->Name;
+            It->Name.Size  = Root->Size + Name.Size;
+            It->Name.Chars = MallocCount<char>(It->Name.Size + 1);
+            Copy(It->Name.Chars, Root->Chars, Root->Size);
+            Copy(It->Name.Chars + Root->Size, Name.Chars, Name.Size);
+            It->Name.Chars[It->Name.Size] = '\0';
+            It->Device = Device->Index;
+            Free(Name.Chars);
+            Device->Listing.Push(It);
+        }
+        Free(Entries.Data);
+    }
+    FlushOutput(); // Warnings, if any.
+}
+
+// All devices at once (sharing the throttle, if any).
+array<file> ReadRoots(array<device> *Devices, listing_options *Options) {
+    array<thread> Threads(Devices->Count);
+    foreach(*Devices) {
+        It->Options = Options;
+        if (It == Devices->Data) continue;
+        Threads.Push(StartThread(ReadDevice, It));
+    }
+    ReadDevice(Devices->Data);
+    foreach(Threads) JoinThread(*It);
+    Free(Threads.Data);
+
+    usize Count = 0;
+    foreach(*Devices) Count += It->Listing.Count;
+    array<file> Listing(Count);
+    foreach(*Devices) {
+        Copy(Listing.PushCount(It->Listing.Count), It->Listing.Data, It->Listing.Count * sizeof(file));
+        Free(It->Listing.Data);
+        It->Listing = array<file>();
+    }
+    return Listing;
+}
+
+// Orders Files by device (keeping the order within each) and sets the range of each. Keys,
+// if there are any, stay with their entries.
+void SplitByDevice(array<file> *Files, array<device> *Devices, array<cache_key> *Keys) {
+    foreach(*Devices) It->End = 0;
+    foreach(*Files) Devices->Data[It->Device].End += 1;
+
+    usize Start = 0;
+    foreach(*Devices) {
+        It->Next = Start;
+        It->Prefetched = Start;
+        Start += It->End;
+        It->End = It->Next;
+    }
+
+    auto Sorted = MallocCount<file>(Files->Count);
+    auto SortedKeys = Keys->Count ? MallocCount<cache_key>(Files->Count) : NULL;
+    for (usize I = 0; I < Files->Count; ++I) {
+        usize To = Devices->Data[Files->Data[I].Device].End++;
+        Sorted[To] = Files->Data[I];
+        if (SortedKeys) SortedKeys[To] = Keys->Data[I];
+    }
+    Free(Files->Data);
+    Files->Data = Sorted;
+    Files->Capacity = Files->Count;
+    if (SortedKeys) {
+        Free(Keys->Data);
+        Keys->Data = SortedKeys;
+        Keys->Capacity = Keys->Count;
+    }
+}
+
+// Progress -------------------------------------------------------------------------------
+
+// The main loop only bumps counters; a thread of its own redraws one status line on stderr
+// ten times a second.
+#define PROGRESS_INTERVAL 100000000llu // 100ms
+
+struct progress {
+    u64 Total;
+    u64 Done;
+    u64 Failed;
+    u64 Running;
+    u64 Started; // Nanoseconds().
+    bool Stop;
+    thread Thread;
+};
+
+// "1h02m", "3m05s", "12s"
+usize FormatDuration(char *Buffer, usize Size, u64 Seconds) {
+    if (Seconds >= 3600) return snprintf(Buffer, Size, FU64 "h%02um", Seconds / 3600, (uint)(Seconds / 60 % 60));
+    if (Seconds >= 60)   return snprintf(Buffer, Size, FU64 "m%02us", Seconds / 60, (uint)(Seconds % 60));
+    return snprintf(Buffer, Size, FU64 "s", Seconds);
+}
+
+void DrawProgress(progress *Progress, bool Final) {
+    u64 Done    = __atomic_load_n(&Progress->Done,    __ATOMIC_RELAXED);
+    u64 Failed  = __atomic_load_n(&Progress->Failed,  __ATOMIC_RELAXED);
+    u64 Running = __atomic_load_n(&Progress->Running, __ATOMIC_RELAXED);
+    u64 Total   = Progress->Total;
+
+    double Elapsed = (double)(Nanoseconds() - Progress->Started) / 1e9;
+    double Rate = Elapsed > 0 ? (double)Done / Elapsed : 0;
+
+    // The total is 0 when not known (entries streamed from a list), then there is no eta.
+    char Count[48];
+    char Eta[32] = "?";
+    if (Total) {
+        snprintf(Count, sizeof(Count), FU64 "/" FU64, Done, Total);
+        if (Rate > 0) FormatDuration(Eta, sizeof(Eta), (u64)((double)(Total - MIN(Done, Total)) / Rate));
+    } else {
+        snprintf(Count, sizeof(Count), FU64, Done);
+    }
+
+    char Line[256];
+    int Size = snprintf(Line, sizeof(Line),
+        "\r" c_grey "[" c_default "%s" c_grey "] " c_default "%.1f/s" c_grey "%s" c_default "%s"
+        c_grey " running " c_default FU64 c_grey " failed " "%s" FU64 c_default "\33[K%s",
+        Count, Rate, Total ? " eta " : "", Total ? Eta : "", Running, Failed ? "" c_red : "" c_default, Failed, Final ? "\n" : "");
+    WriteStderr(Line, (usize)MIN(Size, (int)sizeof(Line) - 1));
+}
+
+void ProgressThread(void *Progress_) {
+    auto Progress = (progress *)Progress_;
+    while (!__atomic_load_n(&Progress->Stop, __ATOMIC_ACQUIRE)) {
+        DrawProgress(Progress, false);
+        SleepNanoseconds(PROGRESS_INTERVAL);
+    }
+}
+
+void StartProgress(progress *Progress, u64 Total) {
+    Progress->Total   = Total;
+    Progress->Started = Nanoseconds();
+    Progress->Thread  = StartThread(ProgressThread, Progress);
+}
+
+void StopProgress(progress *Progress) {
+    if (!Progress->Thread) return;
+    __atomic_store_n(&Progress->Stop, true, __ATOMIC_RELEASE);
+    JoinThread(Progress->Thread);
+    Progress->Thread = NULL;
+    DrawProgress(Progress, true);
+}
+
+// ---------------------------------------------------------------------------------------
+
+// Timeouts and speculation -------------------------------------------------------------
+
+// --timeout sends SIGTERM to the child's process group, then SIGKILL if it is still around
+// this much later.
+#define TIMEOUT_KILL_GRACE 5000000000llu // 5s
+
+// With --speculate, once every entry has been started, one that has run this many times
+// longer than the median of the finished ones gets a second copy; the first to succeed
+// wins and the other one is killed.
+#define SPECULATE_FACTOR         2
+#define SPECULATE_MIN_COMPLETED  3 // Before there is a median worth trusting.
+
+// A running (or free) child process.
+struct slot {
+    bool Busy;
+    process_id Process;
+    file *File;
+    struct stage *Stage;
+    array<char> Command; // Reused between entries.
+    u64 Started;         // Nanoseconds().
+    bool TimedOut;       // SIGTERM sent.
+    bool Killed;         // SIGKILL sent.
+    bool Cancelled;      // Lost the race to its twin, its exit code does not matter.
+    bool Speculative;    // The second copy, never copied again.
+    slot *Twin;          // The other copy of the same entry while both run.
+    struct host *Host;   // Where it runs with --hosts, NULL for here.
+};
+
+u64 MedianRuntime(array<u64> *Runtimes) {
+    Sort(Runtimes->Data, Runtimes->Count, [](u64 A, u64 B) { return A < B; });
+    return Runtimes->Data[Runtimes->Count / 2];
+}
+
+str * OptionValue(array<str> *Args, str *Option) {
+    if (Option + 1 >= &Args->Data[Args->Count]) {
+        Printf(c_dim_red "[E]" c_grey " Missing value for " c_dim_yellow FSTR c_default "\n", (int)Option->Size, Option->Chars);
+        Exit(0);
+    }
+    return Option + 1;
+}
+
+u64 OptionNumber(str *Option, str *Value) {
+    u64 Result = 0;
+    if (!Value->ParseU64(&Result)) {
+        Printf(c_dim_red "[E]" c_grey " Expected a number for " c_dim_yellow FSTR c_grey ", got \"" FSTR "\"" c_default "\n",
+            (int)Option->Size, Option->Chars, (int)Value->Size, Value->Chars);
+        Exit(0);
+    }
+    return Result;
+}
+
+// A number of bytes, with an optional K, M or G (binary) after it.
+u64 OptionSize(str *Option, str *Value) {
+    auto Digits = *Value;
+    u64 Unit = 1;
+    if (Digits.Size > 1) {
+        switch (Digits.Chars[Digits.Size - 1]) {
+            case 'K': case 'k': Unit = KILOBYTES(1); break;
+            case 'M': case 'm': Unit = MEGABYTES(1); break;
+            case 'G': case 'g': Unit = GIGABYTES(1); break;
+        }
+    }
+    if (Unit > 1) Digits.Size -= 1;
+    return OptionNumber(Option, &Digits) * Unit;
+}
+
+// Pipelines (--then) ----------------------------------------------------------------------
+
+// One command of a "--then" chain. An entry moves on to the next stage as soon as its
+// command here exits 0, so stages overlap and each one has its own job limit.
+struct stage {
+    str *Program;
+    str ProgramPath;
+    slice<str> Commands;
+    array<command_token> Tokens;
+    uint Limit;           // Stage 0 goes by Concurrency.Limit instead (without --jobfile).
+    uint Running;
+    array<file *> Queue;  // Done with the previous stage, waiting for this one (not stage 0).
+    usize Next;           // Next entry to start: index into Queue, or into Files for stage 0.
+    array<u64> Runtimes;  // Of the successful ones, for --speculate.
+    u64 Median;
+    uint Depth;           // In its chain, 0 for the first (with --jobfile, every job has a chain).
+    bool Last;            // Of its chain.
+    bool Stdin;           // Has ":stdin": gets the entry's content on standard input.
+};
+
+// Splits "prog args... --then [-j N] prog2 args... --then ..." into stages.
+array<stage> ParseStages(str *Program, slice<str> Commands, uint DefaultLimit) {
+    array<stage> Stages(4);
+    auto ArgThen     = str("--then");
+    auto ArgJobs     = str("-j");
+    auto ArgJobsLong = str("--jobs");
+
+    auto Stage = Stages.Push();
+    *Stage = {};
+    Stage->Program = Program;
+    Stage->Limit   = DefaultLimit;
+    Stage->Depth   = 0;
+
+    usize First = 0;
+    for (usize I = 0; I < Commands.Count; ++I) {
+        auto Arg = &Commands.Data[I];
+        if (!Arg->Equal(ArgThen)) continue;
+        Stage->Commands = slice<str>(Commands.Data + First, I - First);
+
+        Stage = Stages.Push();
+        *Stage = {};
+        Stage->Limit = DefaultLimit;
+        Stage->Depth = (uint)Stages.Count - 1;
+        if (I + 1 < Commands.Count && (Commands.Data[I + 1].Equal(ArgJobs) || Commands.Data[I + 1].Equal(ArgJobsLong))) {
+            if (I + 2 >= Commands.Count) {
+                Printf(c_dim_red "[E]" c_grey " Missing value for " c_dim_yellow "-j" c_grey " after --then" c_default "\n");
+                Exit(0);
+            }
+            Stage->Limit = (uint)MAX(OptionNumber(&Commands.Data[I + 1], &Commands.Data[I + 2]), 1llu);
+            I += 2;
+        }
+        if (I + 1 >= Commands.Count) {
+            Printf(c_dim_red "[E]" c_grey " No program to run after --then." c_default "\n");
+            Exit(0);
+        }
+        I += 1;
+        Stage->Program = &Commands.Data[I];
+        First = I + 1;
+    }
+    Stage->Commands = slice<str>(Commands.Data + First, Commands.Count - First);
+    Stage->Last     = true;
+
+    return Stages;
+}
+
+// Job files ("--jobfile") ----------------------------------------------------------------
+
+// Several commands over one listing: every entry is offered to each job (that it passes the
+// filter of) and is done once all of them are done with it. One job per line:
+//
+//     [-j N] [--files|--dirs] [--match GLOB] PROGRAM ARGS... [--then ...]
+//
+// Words are split as a shell would (quotes, backslashes), "#" starts a comment line. GLOB is
+// matched like a .gitignore line: against the name, or the whole path if it has a "/".
+struct job {
+    bool DoFiles;
+    bool DoDirs;
+    array<ignore_rule> Match; // None for every entry.
+    usize FirstStage;         // Its chain in Stages.
+};
+
+// One line of the job file into zero-terminated words, unquoted in place.
+array<str> SplitWords(char *C, char *End) {
+    array<str> Words;
+    while (C < End) {
+        while (C < End && (*C == ' ' || *C == '\t' || *C == '\r')) ++C;
+        if (C == End) break;
+
+        char *Word = C;
+        char *Out  = C;
+        char Quote = 0;
+        for (; C < End && (Quote || (*C != ' ' && *C != '\t' && *C != '\r')); ++C) {
+            if (Quote && *C == Quote) Quote = 0;
+            else if (!Quote && (*C == '"' || *C == '\'')) Quote = *C;
+            else if (*C == '\\' && Quote != '\'' && C + 1 < End) *Out++ = *++C;
+            else *Out++ = *C;
+        }
+        Words.Push(str(Word, (usize)(Out - Word)));
+        if (C < End) ++C;
+        *Out = '\0'; // Arguments must be zero-terminated (see Launch), the separator goes.
+    }
+    return Words;
+}
+
+bool JobTakes(job *Job, file *File) {
+    if (File->Type == file_type::File && !Job->DoFiles) return false;
+    if (File->Type == file_type::Directory && !Job->DoDirs) return false;
+    if (Job->Match.Count == 0) return true;
+
+    usize NameStart = File->Name.Size;
+    while (NameStart && File->Name.Chars[NameStart - 1] != '/' && File->Name.Chars[NameStart - 1] != '\\') NameStart -= 1;
+    auto Name = str(File->Name.Chars + NameStart, File->Name.Size - NameStart);
+    return RuleMatches(&Job->Match.Data[0], File->Name, Name, File->Type == file_type::Directory);
+}
+
+// Appends each job's chain of stages to Stages.
+array<job> ParseJobFile(str *Path, array<stage> *Stages, uint DefaultLimit) {
+    mapped_file Map;
+    if (!MapFile(Path, &Map)) {
+        Printf(c_dim_red "[E]" c_grey " Cannot read \"" c_dim_yellow FSTR c_grey "\"" c_default "\n", (int)Path->Size, Path->Chars);
+        Exit(0);
+    }
+    // Kept for good: stages point into it.
+    auto Text = MallocCount<char>(Map.Size + 1);
+    Copy(Text, Map.Data, Map.Size);
+    char *End = Text + Map.Size;
+    UnmapFile(&Map);
+
+    array<job> Jobs;
+    auto ArgJobs     = str("-j");
+    auto ArgJobsLong = str("--jobs");
+    auto ArgFiles    = str("--files");
+    auto ArgDirs     = str("--dirs");
+    auto ArgMatch    = str("--match");
+
+    for (char *Line = Text; Line < End;) {
+        char *LineEnd = (char *)FindByte((u8 *)Line, (u8 *)End, '\n');
+        auto LineWords = SplitWords(Line, LineEnd);
+        Line = LineEnd + 1;
+        if (LineWords.Count == 0 || LineWords.Data[0].Chars[0] == '#') {
+            Free(LineWords.Data);
+            continue;
+        }
+        auto Words = MallocCount<array<str>>(1); // Kept for good too.
+        *Words = LineWords;
+
+        job Job = {};
+        uint Limit = DefaultLimit;
+        str *Program = NULL;
+        foreach(*Words) {
+            auto Arg = It;
+            if (Arg->Equal(ArgJobs) || Arg->Equal(ArgJobsLong)) {
+                Limit = (uint)MAX(OptionNumber(Arg, OptionValue(Words, Arg)), 1llu);
+                It += 1;
+            } else if (Arg->Equal(ArgFiles)) {
+                Job.DoFiles = true;
+            } else if (Arg->Equal(ArgDirs)) {
+                Job.DoDirs = true;
+            } else if (Arg->Equal(ArgMatch)) {
+                auto Pattern = OptionValue(Words, Arg);
+                CompileIgnoreRules(Pattern->Chars, Pattern->Size, &Job.Match);
+                It += 1;
+            } else if (Arg->StartsWith("--")) {
+                Printf(c_dim_red "[E]" c_grey " Unknown job option: " FSTR c_default "\n", (int)Arg->Size, Arg->Chars);
+                Exit(0);
+            } else {
+                Program = Arg;
+                break;
+            }
+        }
+        if (!Program) {
+            Printf(c_dim_red "[E]" c_grey " No program to run in job %d of \"" c_dim_yellow FSTR c_grey "\"" c_default "\n",
+                (int)Jobs.Count + 1, (int)Path->Size, Path->Chars);
+            Exit(0);
+        }
+        if (!Job.DoFiles && !Job.DoDirs) {
+            Job.DoFiles = true;
+            Job.DoDirs  = true;
+        }
+
+        slice<str> Commands;
+        if (Program + 1 < &Words->Data[Words->Count]) Commands = Words->SliceStartingWith(Program + 1);
+        auto Chain = ParseStages(Program, Commands, Limit);
+        Job.FirstStage = Stages->Count;
+        Copy(Stages->PushCount(Chain.Count), Chain.Data, Chain.Count * sizeof(stage));
+        Free(Chain.Data);
+        Jobs.Push(Job);
+    }
+
+    if (Jobs.Count == 0) {
+        Printf(c_dim_red "[E]" c_grey " No jobs in \"" c_dim_yellow FSTR c_grey "\"" c_default "\n", (int)Path->Size, Path->Chars);
+        Exit(0);
+    }
+    return Jobs;
+}
+
+// Hosts ("--hosts") ----------------------------------------------------------------------
+
+// Commands can run on other machines (that see the same files) through a launcher: a
+// command of our own, like "ssh {host} --", that the expanded command is appended to. One
+// host per line, with how many commands it may run at once:
+//
+//     HOST [SLOTS]
+//
+// Words are split as in job files, "#" starts a comment line. With ssh as the launcher, an
+// exit code of 255 is its own failure to run the command: a host that has HOST_FAILURE_LIMIT
+// of those in a row is taken out of the rotation, and what failed there runs on another one,
+// up to one try per host. Any other launcher's 255 could be the command's, so it is taken
+// as that.
+#define LAUNCHER_FAILED    255
+#define HOST_FAILURE_LIMIT 3
+
+struct host {
+    str  Name;
+    uint Slots;
+    uint Running;
+    uint Failures;       // Of the launcher, in a row.
+    bool Out;            // Of the rotation.
+    array<str> Launcher; // Its words, "{host}" replaced.
+};
+
+static str ReplaceHost(str *Word, str *Host) {
+    auto Pattern = str("{host}");
+    array<char> Result(Word->Size + Host->Size + 1);
+    for (usize I = 0; I < Word->Size;) {
+        if (Word->Size - I >= Pattern.Size && str(Word->Chars + I, Pattern.Size).Equal(Pattern)) {
+            Append(&Result, *Host);
+            I += Pattern.Size;
+        } else {
+            Result.Push(Word->Chars[I++]);
+        }
+    }
+    Result.Push('\0');
+    return str(Result.Data, Result.Count - 1);
+}
+
+array<host> ParseHostFile(str *Path, array<str> *Launcher) {
+    mapped_file Map;
+    if (!MapFile(Path, &Map)) {
+        Printf(c_dim_red "[E]" c_grey " Cannot read \"" c_dim_yellow FSTR c_grey "\"" c_default "\n", (int)Path->Size, Path->Chars);
+        Exit(0);
+    }
+    // Kept for good: host names point into it.
+    auto Text = MallocCount<char>(Map.Size + 1);
+    Copy(Text, Map.Data, Map.Size);
+    char *End = Text + Map.Size;
+    UnmapFile(&Map);
+
+    array<host> Hosts;
+    for (char *Line = Text; Line < End;) {
+        char *LineEnd = (char *)FindByte((u8 *)Line, (u8 *)End, '\n');
+        auto Words = SplitWords(Line, LineEnd);
+        Line = LineEnd + 1;
+        if (Words.Count == 0 || Words.Data[0].Chars[0] == '#') {
+            Free(Words.Data);
+            continue;
+        }
+
+        auto Host = Hosts.Push();
+        *Host = {};
+        Host->Name  = Words.Data[0];
+        Host->Slots = 1;
+        u64 Slots = 0;
+        if (Words.Count > 2 || (Words.Count == 2 && (!Words.Data[1].ParseU64(&Slots) || Slots == 0))) {
+            Printf(c_dim_red "[E]" c_grey " Expected \"HOST [SLOTS]\" for host %d of \"" c_dim_yellow FSTR c_grey "\"" c_default "\n",
+                (int)Hosts.Count, (int)Path->Size, Path->Chars);
+            Exit(0);
+        }
+        if (Slots) Host->Slots = (uint)Slots;
+        Host->Launcher = array<str>(Launcher->Count);
+        foreach(*Launcher) Host->Launcher.Push(ReplaceHost(It, &Host->Name));
+        Free(Words.Data);
+    }
+
+    if (Hosts.Count == 0) {
+        Printf(c_dim_red "[E]" c_grey " No hosts in \"" c_dim_yellow FSTR c_grey "\"" c_default "\n", (int)Path->Size, Path->Chars);
+        Exit(0);
+    }
+    return Hosts;
+}
+
+// Output cache ("--cache") ---------------------------------------------------------------
+
+// Outputs (--output) of earlier runs, kept in Directory under a key made of the entry's
+// content and every command it goes through, expanded. A hit restores the output with a
+// reflink instead of running anything. Where the file system has no reflinks it is a copy,
+// never a hard link: a later run writing its output in place would write into the cache.
+struct output_cache {
+    str Directory; // Ending in a separator, empty without --cache.
+    array<stage> *Stages;
+    array<command_token> *OutputTokens;
+    bool DryRun;
+};
+
+// Scratch space, one per thread.
+struct cache_buffers {
+    array<array<char>> Args;
+    array<str> Expanded;
+    array<char> Text;
+    array<char> Path;
+};
+
+void FreeCacheBuffers(cache_buffers *Buffers) {
+    foreach(Buffers->Args) Free(It->Data);
+    Free(Buffers->Args.Data);
+    Free(Buffers->Expanded.Data);
+    Free(Buffers->Text.Data);
+    Free(Buffers->Path.Data);
+}
+
+// The content is hashed with two seeds, 128 bits between them: a collision would quietly
+// hand out the output of some other input. False for what has no content (directories).
+bool CacheKey(output_cache *Cache, file *File, cache_key *Key, cache_buffers *Buffers) {
+    if (Key->Hash[0] || Key->Hash[1]) return true;
+    mapped_file Map;
+    if (File->Type != file_type::File || !MapFile(&File->Name, &Map)) return false;
+    u64 Content[2] = {Hash64(Map.Data, Map.Size, 0), Hash64(Map.Data, Map.Size, 1)};
+    UnmapFile(&Map);
+
+    auto Text = &Buffers->Text;
+    Text->Reset();
+    Copy(Text->PushCount(sizeof(Content)), Content, sizeof(Content));
+    foreach(*Cache->Stages) {
+        ExpandCommand(&It->Tokens, File, &Buffers->Args, &Buffers->Expanded);
+        Append(Text, *It->Program);
+        Text->Push('\0');
+        foreach(Buffers->Expanded) {
+            Append(Text, *It);
+            Text->Push('\0');
+        }
+        Text->Push('\n');
+    }
+
+    Key->Hash[0] = Hash64(Text->Data, Text->Count, 0);
+    Key->Hash[1] = Hash64(Text->Data, Text->Count, 1);
+    return true;
+}
+
+// "Directory/<32 hex digits>", zero-terminated, in Path.
+str CachePath(output_cache *Cache, cache_key *Key, array<char> *Path) {
+    Path->Reset();
+    Append(Path, Cache->Directory);
+    for (int I = 0; I < 2; ++I) {
+        for (int Shift = 60; Shift >= 0; Shift -= 4) Path->Push("0123456789abcdef"[(Key->Hash[I] >> Shift) & 15]);
+    }
+    Path->Push('\0');
+    return str(Path->Data, Path->Count - 1);
+}
+
+// True if the output was restored (in a dry run: is there to be).
+bool RestoreFromCache(output_cache *Cache, file *File, cache_key *Key, cache_buffers *Buffers) {
+    if (!CacheKey(Cache, File, Key, Buffers)) return false;
+    auto Stored = CachePath(Cache, Key, &Buffers->Path);
+    ExpandCommand(Cache->OutputTokens, File, &Buffers->Args, &Buffers->Expanded);
+    if (Cache->DryRun) return FileType(&Stored) == file_type::File;
+    return CloneFile(&Stored, &Buffers->Expanded.Data[0]);
+}
+
+// Once the last command of an entry has succeeded.
+void StoreInCache(output_cache *Cache, file *File, cache_key *Key, cache_buffers *Buffers) {
+    if (!Key->Hash[0] && !Key->Hash[1]) return;
+    auto Stored = CachePath(Cache, Key, &Buffers->Path);
+    ExpandCommand(Cache->OutputTokens, File, &Buffers->Args, &Buffers->Expanded);
+    auto Output = &Buffers->Expanded.Data[0];
+    if (!CloneFile(Output, &Stored)) {
+        Printf(c_yellow "[W]" c_grey " Cannot store \"" c_dim_yellow FSTR c_grey "\" in the cache." c_default "\n",
+            (int)Output->Size, Output->Chars);
+    }
+}
+
+struct cache_lookup {
+    output_cache *Cache;
+    file *Files;
+    cache_key *Keys;
+    bool *Restored;
+};
+
+void LookUpCacheEntry(void *Lookup_, usize Index) {
+    auto Lookup = (cache_lookup *)Lookup_;
+    cache_buffers Buffers;
+    Lookup->Restored[Index] = RestoreFromCache(Lookup->Cache, &Lookup->Files[Index], &Lookup->Keys[Index], &Buffers);
+    FreeCacheBuffers(&Buffers);
+}
+
+// Hashes every entry in parallel and restores the hits, which move from Files to Restored.
+// The misses keep their keys in Keys, one for each that stays in Files, for StoreInCache().
+void RestoreCached(output_cache *Cache, array<file> *Files, array<file> *Restored, array<cache_key> *Keys) {
+    array<bool> Hits(Files->Count);
+    Hits.PushCount(Files->Count);
+    *Keys = array<cache_key>(Files->Count);
+    for (usize I = 0; I < Files->Count; ++I) *Keys->Push() = {};
+
+    cache_lookup Lookup;
+    Lookup.Cache    = Cache;
+    Lookup.Files    = Files->Data;
+    Lookup.Keys     = Keys->Data;
+    Lookup.Restored = Hits.Data;
+    ParallelFor(Files->Count, LookUpCacheEntry, &Lookup);
+
+    usize Kept = 0;
+    for (usize I = 0; I < Files->Count; ++I) {
+        if (Hits.Data[I]) {
+            Restored->Push(&Files->Data[I]);
+        } else {
+            Keys->Data[Kept]    = Keys->Data[I];
+            Files->Data[Kept++] = Files->Data[I];
+        }
+    }
+    Files->Count = Keys->Count = Kept;
+
+    Free(Hits.Data);
+}
+
+// Background removal ("--del") -----------------------------------------------------------
+
+// An entry is not removed in place: it is renamed into a trash directory, which is instant
+// however big a tree it is, and threads of their own remove it from there while
+// commands go on. They sleep until the main loop queues something. Whatever a run leaves in the trash (killed, or failed and exited) goes
+// once the next one with --del starts there.
+#define TRASH_NAME     ".fef-trash"
+#define TRASH_THREADS  4
+
+struct trash_bin {
+    str Parent; // An --in root, "" for the working directory.
+    str Path;   // Ending in a separator.
+    bool Usable;
+};
+
+struct trash {
+    array<trash_bin> Bins;
+    trash_bin *LastBin;
+    throttle *Throttle;
+    u64 Run;          // What is renamed into a bin becomes "Run-Thrown".
+    u64 Thrown;
+    array<str> Queue; // To remove, under Lock.
+    usize Next;
+    int Lock;
+    semaphore Queued; // Signaled once per path queued, and once per worker on closing.
+    uint Workers;     // Each gets an index.
+    array<thread> Threads;
+};
+
+bool IsTrash(str *Name) {
+    usize Size = sizeof(TRASH_NAME) - 1;
+    if (Name->Size < Size || !str(Name->Chars + Name->Size - Size, Size).Equal(str(TRASH_NAME))) return false;
+    if (Name->Size == Size) return true;
+    char Before = Name->Chars[Name->Size - Size - 1];
+    return Before == '/' || Before == '\\';
+}
+
+str JoinPath(str *Directory, const char *Name, bool Separated = false) {
+    usize Size = Directory->Size + strlen(Name) + Separated;
+    auto Chars = MallocCount<char>(Size + 1);
+    Copy(Chars, Directory->Chars, Directory->Size);
+    Copy(Chars + Directory->Size, Name, strlen(Name));
+    if (Separated) Chars[Size - 1] = PATH_SEPARATOR;
+    Chars[Size] = '\0';
+    return str(Chars, Size);
+}
+
+void QueueRemoval(trash *Trash, str Path) {
+    SpinLock(&Trash->Lock);
+    if (Trash->Next == Trash->Queue.Count) {
+        Trash->Queue.Reset();
+        Trash->Next = 0;
+    }
+    Trash->Queue.Push(Path);
+    SpinUnlock(&Trash->Lock);
+    SignalSemaphore(Trash->Queued);
+}
+
+void TrashWorker(void *Trash_) {
+    auto Trash = (trash *)Trash_;
+    uint Index = __atomic_fetch_add(&Trash->Workers, 1, __ATOMIC_RELAXED);
+
+    for (;;) {
+        WaitSemaphore(Trash->Queued);
+        str Path = {};
+        SpinLock(&Trash->Lock);
+        if (Trash->Next < Trash->Queue.Count) Path = Trash->Queue.Data[Trash->Next++];
+        SpinUnlock(&Trash->Lock);
+        if (!Path.Chars) break; // StopTrash() has been, and the queue is done with.
+
+        u64 Begin = Tracing ? Nanoseconds() : 0;
+        Delete(&Path, Trash->Throttle);
+        if (Tracing) TraceSpan("delete", TRACK_TRASH(Index), Begin, Nanoseconds(), Path.Chars, Path.Size);
+        Free(Path.Chars);
+        FlushOutput(); // Errors, if any.
+    }
+}
+
+// The bin in Parent, made the first time and emptied of what an earlier run left.
+trash_bin *TrashBin(trash *Trash, str Parent) {
+    if (Trash->LastBin && Trash->LastBin->Parent.Equal(Parent)) return Trash->LastBin;
+    foreach(Trash->Bins) {
+        if (It->Parent.Equal(Parent)) return Trash->LastBin = It;
+    }
+
+    auto Bin = Trash->Bins.Push();
+    Bin->Parent = str::Copy(Parent.Chars, Parent.Size);
+    Bin->Path   = JoinPath(&Parent, TRASH_NAME, true);
+    Bin->Usable = MakeDirectory(&Bin->Path);
+    if (Bin->Usable) {
+        auto Leftovers = ReadDirectory(&Bin->Path);
+        foreach(Leftovers) {
+            QueueRemoval(Trash, JoinPath(&Bin->Path, It->Name.Chars));
+            Free(It->Name.Chars);
+        }
+        Free(Leftovers.Data);
+    }
+    return Trash->LastBin = Bin; // Pointers into Bins only live until the next Push.
+}
 
-                        Printf(c_dim_red "[E]" c_grey " Unexpected token: " c_dim_yellow ":" FSTR c_grey c_default "\n", (int)Token.Str.Size, Token.Str.Chars);
-                        Exit(0);
-                    }
-                }
-            }
+void StartTrash(trash *Trash, throttle *Throttle) {
+    Trash->Throttle = Throttle;
+    Trash->Run      = Nanoseconds();
+    Trash->Queued   = MakeSemaphore();
+    if (Tracing) for (uint I = 0; I < TRASH_THREADS; ++I) TraceName(TRACK_TRASH(I), "trash", (int)I);
+    for (uint I = 0; I < TRASH_THREADS; ++I) Trash->Threads.Push(StartThread(TrashWorker, Trash));
+}
 
-            C.Chars += Token.Str.Size;
-            C.Size  -= Token.Str.Size;
+// Renamed out of the way now, removed later. Where that cannot be done (no bin, or the bin
+// is on another file system) it is still removed later, under its own name.
+// There is one bin per run at the top of the walk: the --in root the entry is under, else
+// the working directory's. A bin next to the entry could be inside a directory thrown away
+// later, and that rename would move it while a worker is removing in it.
+void ThrowAway(trash *Trash, file *File) {
+    trash_bin *Bin = NULL;
+    foreach(Trash->Bins) {
+        if (!It->Parent.Size || !File->Name.StartsWith(It->Parent)) continue;
+        if (!Bin || It->Parent.Size < Bin->Parent.Size) Bin = It; // The outermost of nested roots.
+    }
+    if (!Bin) Bin = TrashBin(Trash, str((char *)"", 0));
 
-            Tokens.Push(Token);
+    if (Bin->Usable) {
+        char Name[48];
+        snprintf(Name, sizeof(Name), FU64 "-" FU64, Trash->Run, Trash->Thrown++);
+        auto Thrown = JoinPath(&Bin->Path, Name);
+        if (RenamePath(&File->Name, &Thrown)) {
+            QueueRemoval(Trash, Thrown);
+            return;
         }
+        Free(Thrown.Chars);
     }
+    QueueRemoval(Trash, str::Copy(File->Name.Chars, File->Name.Size));
+}
 
-    return Tokens;
+// Waits for everything thrown out to be gone, then removes the bins.
+void StopTrash(trash *Trash) {
+    if (Trash->Threads.Count) {
+        SignalSemaphore(Trash->Queued, (uint)Trash->Threads.Count); // Each stops at an empty queue.
+        foreach(Trash->Threads) JoinThread(*It);
+        Trash->Threads.Count = 0;
+        FreeSemaphore(Trash->Queued);
+    }
+
+    foreach(Trash->Bins) {
+        if (It->Usable) Delete(&It->Path, Trash->Throttle);
+    }
+}
+
+// Recursive removal ("-r --del") ---------------------------------------------------------
+
+// A directory is listed after what is in it, but with more than one command at a time its
+// own can be done first. It is thrown away only once every entry listed below it is.
+struct removal_order {
+    name_index Directories; // Those run on.
+    array<uint> Below;      // Per slot of Directories: entries below it not thrown away yet.
+    array<bool> Waiting;    // Per slot: its command is done, but Below is not 0 yet.
+};
+
+// The nearest directory run on above Name, NULL if there is none.
+file *EnclosingDirectory(removal_order *Order, str Name) {
+    for (usize Size = Name.Size; Size-- > 0;) {
+        if (Name.Chars[Size] != '/' && Name.Chars[Size] != '\\') continue;
+        if (auto Found = FindName(&Order->Directories, str(Name.Chars, Size))) return Found;
+    }
+    return NULL;
+}
+
+void StartRemovalOrder(removal_order *Order, array<file> *Files) {
+    array<file> Directories;
+    foreach(*Files) if (It->Type == file_type::Directory) Directories.Push(*It);
+    Order->Directories = BuildNameIndex(&Directories);
+    Free(Directories.Data);
+
+    usize Capacity = Order->Directories.Mask + 1;
+    Order->Below   = array<uint>(Capacity);
+    Order->Waiting = array<bool>(Capacity);
+    for (usize I = 0; I < Capacity; ++I) {
+        Order->Below.Push((uint)0);
+        Order->Waiting.Push(false);
+    }
+    foreach(*Files) {
+        if (auto Above = EnclosingDirectory(Order, It->Name)) Order->Below.Data[Above - Order->Directories.Slots] += 1;
+    }
+}
+
+// Once File's command is done: what can be thrown away now goes into Ready, innermost
+// first. That is File unless it waits for entries below it, and then the directories
+// above it that were only waiting for File.
+void ReadyForRemoval(removal_order *Order, file *File, array<file *> *Ready) {
+    for (;;) {
+        auto Own = File->Type == file_type::Directory ? FindName(&Order->Directories, File->Name) : NULL;
+        if (Own && Order->Below.Data[Own - Order->Directories.Slots]) {
+            Order->Waiting.Data[Own - Order->Directories.Slots] = true;
+            return;
+        }
+        Ready->Push(File);
+
+        auto Above = EnclosingDirectory(Order, File->Name);
+        if (!Above) return;
+        usize Slot = (usize)(Above - Order->Directories.Slots);
+        if (--Order->Below.Data[Slot] || !Order->Waiting.Data[Slot]) return;
+        File = Above; // A copy, with the same name.
+    }
 }
 
 void Main(array<str> *Args, str *Exe, str *Cwd) {
@@ -86,12 +2127,119 @@ void Main(array<str> *Args, str *Exe, str *Cwd) {
             "            (If neither is present will do both files and directories.)\n"
             "  --dry   - Do not perform an operation, just echo it to the console.\n"
             "  --del   - Delete file or directory afterwards (only if program was run successfully.\n"
+            "            It is moved at once into a .fef-trash directory in its --in root (or the\n"
+            "            working directory) and removed from there in the background.\n"
+            "  -v      - Echo every command as it starts (otherwise only a progress line is\n"
+            "            shown, when stderr is a terminal).\n"
+            "  -j N    - Run up to N commands at once (default 1).\n"
+            "  -j auto - Adjust the number of commands running at once to CPU, memory and I/O\n"
+            "            pressure, between --jobs-min and --jobs-max.\n"
+            "  --jobs-min N    - Lower bound for \"-j auto\" (default 1).\n"
+            "  --jobs-max N    - Upper bound for \"-j auto\" (default 4 per CPU).\n"
+            "  --mem-reserve M - Hold new commands while less than M megabytes of memory is\n"
+            "                    available (default 256 with \"-j auto\", off otherwise).\n"
+            "  --pin cores|numa - Spread commands round-robin over CPU cores or NUMA nodes\n"
+            "                     (CPU and memory), one per running slot.\n"
+            "  --nice N         - Run commands with nice value raised by N.\n"
+            "  --ioprio idle|best-effort - Run commands in the idle or lowest best-effort\n"
+            "                              disk I/O class.\n"
+            "  --shard i/N       - Only process entries of shard i (0-based) out of N, picked by\n"
+            "                      a hash of their name: N machines running the same command\n"
+            "                      over the same directory each get a disjoint share.\n"
+            "  --shard-by-size   - Balance shards by file size instead of by entry count.\n"
+            "  --dedup-content   - Run the command once per distinct file content (the first\n"
+            "                      file by name), skipping byte-identical copies.\n"
+            "  --dedup-link      - Like --dedup-content, and replace the skipped copies with\n"
+            "                      hard links to the file that was kept.\n"
+            "  --max-rate N      - Start at most N commands per second. Directory entries read\n"
+            "                      and files removed with --del count against it too.\n"
+            "  --max-io M        - Start commands on at most M megabytes of input per second\n"
+            "                      (by file size).\n"
+            "  --prefetch K      - Have the next K files read into the page cache while the\n"
+            "                      current ones run (the next K of each device with --in).\n"
+            "  --drop-cache      - Drop each file from the page cache once its command has\n"
+            "                      succeeded, so one pass over lots of data does not push\n"
+            "                      out everyone else's.\n"
+            "  --output TEMPLATE - Skip entries whose output (TEMPLATE expanded like the\n"
+            "                      command, e.g. \":name.gz\") exists and is not older.\n"
+            "  --cache DIR       - With --output: keep every output in DIR, keyed by a hash of\n"
+            "                      the input's content and the expanded commands, and restore\n"
+            "                      it from there instead of running the same commands on the\n"
+            "                      same content again. Outputs are reflinked where the file\n"
+            "                      system can, copied otherwise. Commands must be\n"
+            "                      deterministic.\n"
+            "  --from FILE|-     - Run on the names listed in FILE (or read from stdin), NUL or\n"
+            "                      newline separated, instead of the working directory.\n"
+            "                      Commands start as soon as the first names come in.\n"
+            "  --from-archive FILE.tar - Run on the files and directories in a tar archive (ustar,\n"
+            "                      GNU or pax) without extracting it: :name is the member's\n"
+            "                      name, and a command with :stdin reads its content from\n"
+            "                      standard input (POSIX). Commands start as soon as the\n"
+            "                      first headers are read.\n"
+            "  --follow-symlinks - Take symbolic links for what they point to (with -r, walk\n"
+            "                      into linked directories, but not into one they are in).\n"
+            "  --unique-inodes   - Run once per file (or directory), not once per hard link or\n"
+            "                      symbolic link to it: the first name listed gets it.\n"
+            "  --chunks SIZE     - Run on every file bigger than SIZE bytes (K, M or G after it\n"
+            "                      for KiB, MiB, GiB) as several entries of about SIZE bytes,\n"
+            "                      each ending at a newline (or the end of the file), for\n"
+            "                      :offset, :length and :chunk.\n"
+            "  --chunk-delimiter C - End chunks after C instead of a newline (\\0 for NUL).\n"
+            "  --jobfile FILE    - Run the jobs in FILE, one per line, over one listing instead of\n"
+            "                      the program given here:\n"
+            "                        [-j N] [--files|--dirs] [--match GLOB] PROGRAM ARGS...\n"
+            "                      Each entry goes to every job it passes the filter of (GLOB\n"
+            "                      as in .gitignore) and counts as done once all are.\n"
+            "  --hosts FILE      - Run commands on other machines that see the same files,\n"
+            "                      through --launcher. One \"HOST [SLOTS]\" per line: up to\n"
+            "                      SLOTS commands at once there (default 1), -j defaults to\n"
+            "                      all of them. Entries go to the host with the most free\n"
+            "                      slots. With ssh as the launcher, a host it fails on (exit\n"
+            "                      code 255) 3 times in a row is left out from then on, and\n"
+            "                      its entries go to the others, up to one try per host.\n"
+            "                      Another launcher's 255 is taken as the command's.\n"
+            "  --launcher CMD    - What runs PROGRAM ARGS... on a host, as \"CMD PROGRAM ARGS...\",\n"
+            "                      {host} replaced by its name (default \"ssh {host} --\").\n"
+            "  --in DIR          - Run on the entries of DIR (as \"DIR/name\") instead of the\n"
+            "                      working directory. Repeat it for several directories: the\n"
+            "                      ones on different devices are read in parallel.\n"
+            "  -r, --recursive   - Also run on everything in subdirectories, as \"sub/name\" (a\n"
+            "                      directory comes after what is in it).\n"
+            "  --ignore-files    - Skip what .gitignore and .fefignore files say (in the\n"
+            "                      directory they are in and below, git's rules), and .git.\n"
+            "                      Ignored directories are not even read.\n"
+            "  --jobs-per-device N - With --in, run at most N commands at once on entries of any\n"
+            "                      one device, taking turns between devices.\n"
+            "  --trace FILE      - Write a timeline of directory reads, command expansion,\n"
+            "                      process starts, commands and removals to FILE, one track\n"
+            "                      per slot (Chrome trace JSON: chrome://tracing, Perfetto).\n"
+            "  --no-fork-server  - Fork commands from fef itself instead of from a small helper\n"
+            "                      process started with it (POSIX), whose fork() stays fast\n"
+            "                      however much memory fef ends up using.\n"
+            "  --alloc-report    - On exit, print allocations by call site: count, bytes, peak\n"
+            "                      live bytes and bytes not freed (DEBUG_ALLOCATIONS builds).\n"
+            "  --timeout S       - Stop commands running longer than S seconds (SIGTERM to\n"
+            "                      everything they started, SIGKILL 5s later); counts as a\n"
+            "                      failure.\n"
+            "  --then [-j N] PROGRAM ARGS... - Chain another command: an entry moves on to it\n"
+            "                      as soon as the previous one exits 0, while other entries\n"
+            "                      are still in earlier stages. Up to N of them at once\n"
+            "                      (default the same as -j).\n"
+            "  --speculate       - Once all entries have started, run a second copy of any\n"
+            "                      command taking over twice the median time and keep\n"
+            "                      whichever finishes first (commands must be idempotent).\n"
             "\n"
             "Patterns:\n"
             "  :name      - Filename or directory name.\n"
             "  :noextname - Filename (without extention if any) or directory name.\n"
             "  :allfiles  - Will output every file name, separated by space.\n"
             "  :alldir    - Will output every directory name, separated by space.\n"
+            "  :stdin     - (An argument of its own, with --from-archive) Pipe the member's content\n"
+            "               to the command's standard input.\n"
+            "  :offset    - Where the entry's bytes start: in its file with --chunks, in the\n"
+            "               archive with --from-archive, 0 otherwise.\n"
+            "  :length    - How many bytes it is (a chunk's, or the whole file's).\n"
+            "  :chunk     - Which chunk of its file it is, from 0.\n"
             "\n"
         );
         Exit(0);
@@ -102,18 +2250,98 @@ void Main(array<str> *Args, str *Exe, str *Cwd) {
         bool DoDirs;
         bool DryRun;
         bool DeleteAfterwards;
+        bool Verbose;
+        bool PinCores;
+        bool PinNuma;
+        bool DedupContent;
+        bool DedupLink;
+        bool Speculate;
+        bool DropCache;
+        bool NoForkServer;
+        bool Recursive;
+        bool IgnoreFiles;
+        bool FollowSymlinks;
+        bool UniqueInodes;
+        str *Output;
+        str *Cache;
+        str *Trace;
+        str *From;
+        str *FromArchive;
+        str *JobFile;
+        str *Hosts;
+        str *Launcher;
         str *ProgramToRun;
     } Options = {};
 
+    shard Shard = {};
+
+    array<str *> Roots;
+    uint DeviceLimit = 0; // 0 for none.
+
+    u64 MaxRate = 0;
+    u64 MaxIo   = 0;
+    u64 Timeout = 0; // Nanoseconds, 0 for none.
+    u64 Prefetch = 0;
+    u64 ChunkSize = 0; // 0 for whole files.
+    u8  ChunkDelimiter = '\n';
+
+    spawn_options Placement = {};
+    Placement.Cpu      = -1;
+    Placement.NumaNode = -1;
+
+    concurrency Concurrency = {};
+    Concurrency.Limit = 1;
+    Concurrency.Min   = 1;
+    Concurrency.Max   = 4 * CpuCount();
+    bool MemoryReserveGiven = false;
+    bool JobsGiven = false;
+
     //
     // Parse command line arguments.
     //
 
     slice<str> Commands; {
-        auto ArgFilesOnly = str("--files");
-        auto ArgDirsOnly  = str("--dirs");
-        auto ArgDryRun    = str("--dry");
-        auto ArgDel       = str("--del");
+        auto ArgFilesOnly  = str("--files");
+        auto ArgDirsOnly   = str("--dirs");
+        auto ArgDryRun     = str("--dry");
+        auto ArgDel        = str("--del");
+        auto ArgVerbose    = str("-v");
+        auto ArgJobs       = str("-j");
+        auto ArgJobsLong   = str("--jobs");
+        auto ArgJobsMin    = str("--jobs-min");
+        auto ArgJobsMax    = str("--jobs-max");
+        auto ArgMemReserve = str("--mem-reserve");
+        auto ArgPin        = str("--pin");
+        auto ArgNice       = str("--nice");
+        auto ArgIoPriority = str("--ioprio");
+        auto ArgShard      = str("--shard");
+        auto ArgShardBySize = str("--shard-by-size");
+        auto ArgDedupContent = str("--dedup-content");
+        auto ArgDedupLink  = str("--dedup-link");
+        auto ArgOutput     = str("--output");
+        auto ArgCache      = str("--cache");
+        auto ArgTrace      = str("--trace");
+        auto ArgMaxRate    = str("--max-rate");
+        auto ArgMaxIo      = str("--max-io");
+        auto ArgTimeout    = str("--timeout");
+        auto ArgSpeculate  = str("--speculate");
+        auto ArgPrefetch   = str("--prefetch");
+        auto ArgDropCache  = str("--drop-cache");
+        auto ArgNoForkServer = str("--no-fork-server");
+        auto ArgRecursive  = str("--recursive");
+        auto ArgIgnoreFiles = str("--ignore-files");
+        auto ArgFollowSymlinks = str("--follow-symlinks");
+        auto ArgUniqueInodes = str("--unique-inodes");
+        auto ArgFrom       = str("--from");
+        auto ArgFromArchive = str("--from-archive");
+        auto ArgChunks     = str("--chunks");
+        auto ArgChunkDelimiter = str("--chunk-delimiter");
+        auto ArgJobFile    = str("--jobfile");
+        auto ArgIn         = str("--in");
+        auto ArgHosts      = str("--hosts");
+        auto ArgLauncher   = str("--launcher");
+        auto ArgDeviceJobs = str("--jobs-per-device");
+        auto ArgAllocReport = str("--alloc-report");
 
         foreach(*Args) {
             auto Arg = It;
@@ -125,124 +2353,1114 @@ void Main(array<str> *Args, str *Exe, str *Cwd) {
                 Options.DryRun = true;
             } else if (Arg->Equal(ArgDel)) {
                 Options.DeleteAfterwards = true;
+            } else if (Arg->Equal(ArgVerbose)) {
+                Options.Verbose = true;
+            } else if (Arg->Equal(ArgJobs) || Arg->Equal(ArgJobsLong)) {
+                auto Value = OptionValue(Args, Arg);
+                if (Value->Equal(str("auto"))) {
+                    Concurrency.Auto = true;
+                } else {
+                    Concurrency.Limit = (uint)MAX(OptionNumber(Arg, Value), 1llu);
+                }
+                JobsGiven = true;
+                It += 1;
+            } else if (Arg->Equal(ArgJobsMin)) {
+                Concurrency.Min = (uint)MAX(OptionNumber(Arg, OptionValue(Args, Arg)), 1llu);
+                It += 1;
+            } else if (Arg->Equal(ArgJobsMax)) {
+                Concurrency.Max = (uint)MAX(OptionNumber(Arg, OptionValue(Args, Arg)), 1llu);
+                It += 1;
+            } else if (Arg->Equal(ArgMemReserve)) {
+                Concurrency.MemoryReserve = OptionNumber(Arg, OptionValue(Args, Arg)) * MEGABYTES(1);
+                MemoryReserveGiven = true;
+                It += 1;
+            } else if (Arg->Equal(ArgPin)) {
+                auto Value = OptionValue(Args, Arg);
+                if (Value->Equal(str("cores"))) {
+                    Options.PinCores = true;
+                } else if (Value->Equal(str("numa"))) {
+                    Options.PinNuma = true;
+                } else {
+                    Printf(c_dim_red "[E]" c_grey " Expected \"cores\" or \"numa\" for --pin" c_default "\n");
+                    Exit(0);
+                }
+#if MACINTOSH_X64
+                Printf(c_yellow "[W]" c_grey " --pin is not supported on MacOS, ignoring it." c_default "\n");
+                Options.PinCores = Options.PinNuma = false;
+#endif
+                It += 1;
+            } else if (Arg->Equal(ArgNice)) {
+                Placement.Nice = (int)MIN(OptionNumber(Arg, OptionValue(Args, Arg)), 19llu);
+                It += 1;
+            } else if (Arg->Equal(ArgIoPriority)) {
+                auto Value = OptionValue(Args, Arg);
+                if (Value->Equal(str("idle"))) {
+                    Placement.IoPriority = io_priority::Idle;
+                } else if (Value->Equal(str("best-effort"))) {
+                    Placement.IoPriority = io_priority::BestEffort;
+                } else {
+                    Printf(c_dim_red "[E]" c_grey " Expected \"idle\" or \"best-effort\" for --ioprio" c_default "\n");
+                    Exit(0);
+                }
+#if WIN_X64
+                Printf(c_yellow "[W]" c_grey " --ioprio is not supported on Windows, ignoring it." c_default "\n");
+                Placement.IoPriority = io_priority::Unchanged;
+#endif
+                It += 1;
+            } else if (Arg->Equal(ArgShard)) {
+                auto Value = OptionValue(Args, Arg);
+                auto Index = str::Until(*Value, '/');
+                auto Count = str(Value->Chars + Index.Size + 1, Value->Size - MIN(Index.Size + 1, Value->Size));
+                if (!Index.ParseU64(&Shard.Index) || !Count.ParseU64(&Shard.Count) || Shard.Index >= Shard.Count) {
+                    Printf(c_dim_red "[E]" c_grey " Expected \"i/N\" with 0 <= i < N for --shard, got \"" FSTR "\"" c_default "\n",
+                        (int)Value->Size, Value->Chars);
+                    Exit(0);
+                }
+                It += 1;
+            } else if (Arg->Equal(ArgShardBySize)) {
+                Shard.BySize = true;
+            } else if (Arg->Equal(ArgDedupContent)) {
+                Options.DedupContent = true;
+            } else if (Arg->Equal(ArgDedupLink)) {
+                Options.DedupContent = true;
+                Options.DedupLink    = true;
+            } else if (Arg->Equal(ArgMaxRate)) {
+                MaxRate = OptionNumber(Arg, OptionValue(Args, Arg));
+                It += 1;
+            } else if (Arg->Equal(ArgMaxIo)) {
+                MaxIo = OptionNumber(Arg, OptionValue(Args, Arg)) * MEGABYTES(1);
+                It += 1;
+            } else if (Arg->Equal(ArgTimeout)) {
+                Timeout = OptionNumber(Arg, OptionValue(Args, Arg)) * 1000000000llu;
+                It += 1;
+            } else if (Arg->Equal(ArgSpeculate)) {
+                Options.Speculate = true;
+            } else if (Arg->Equal(ArgPrefetch)) {
+                Prefetch = OptionNumber(Arg, OptionValue(Args, Arg));
+#if WIN_X64
+                Printf(c_yellow "[W]" c_grey " --prefetch is not supported on Windows, ignoring it." c_default "\n");
+                Prefetch = 0;
+#endif
+                It += 1;
+            } else if (Arg->Equal(ArgDropCache)) {
+                Options.DropCache = true;
+#if WIN_X64 || MACINTOSH_X64
+                Printf(c_yellow "[W]" c_grey " --drop-cache is only supported on Linux, ignoring it." c_default "\n");
+                Options.DropCache = false;
+#endif
+            } else if (Arg->Equal(ArgRecursive) || Arg->Equal(str("-r"))) {
+                Options.Recursive = true;
+            } else if (Arg->Equal(ArgIgnoreFiles)) {
+                Options.IgnoreFiles = true;
+            } else if (Arg->Equal(ArgFollowSymlinks)) {
+                Options.FollowSymlinks = true;
+#if WIN_X64
+                Printf(c_yellow "[W]" c_grey " --follow-symlinks is not supported on Windows (directory links are always followed), ignoring it." c_default "\n");
+                Options.FollowSymlinks = false;
+#endif
+            } else if (Arg->Equal(ArgUniqueInodes)) {
+                Options.UniqueInodes = true;
+#if WIN_X64
+                Printf(c_yellow "[W]" c_grey " --unique-inodes is not supported on Windows, ignoring it." c_default "\n");
+                Options.UniqueInodes = false;
+#endif
+            } else if (Arg->Equal(ArgNoForkServer)) {
+                Options.NoForkServer = true; // Windows has no fork() to avoid anyway.
+            } else if (Arg->Equal(ArgAllocReport)) {
+#if DEBUG_ALLOCATIONS
+                AllocationReportAtExit = true;
+#else
+                Printf(c_yellow "[W]" c_grey " --alloc-report needs a build with DEBUG_ALLOCATIONS, ignoring it." c_default "\n");
+#endif
+            } else if (Arg->Equal(ArgFrom)) {
+                Options.From = OptionValue(Args, Arg);
+                It += 1;
+            } else if (Arg->Equal(ArgFromArchive)) {
+                Options.FromArchive = OptionValue(Args, Arg);
+#if WIN_X64
+                Printf(c_dim_red "[E]" c_grey " --from-archive is not supported on Windows." c_default "\n");
+                Exit(0);
+#endif
+                It += 1;
+            } else if (Arg->Equal(ArgChunks)) {
+                ChunkSize = OptionSize(Arg, OptionValue(Args, Arg));
+                if (ChunkSize == 0) {
+                    Printf(c_dim_red "[E]" c_grey " --chunks needs a size above 0." c_default "\n");
+                    Exit(0);
+                }
+                It += 1;
+            } else if (Arg->Equal(ArgChunkDelimiter)) {
+                auto Value = OptionValue(Args, Arg);
+                if      (Value->Equal(str("\\n"))) ChunkDelimiter = '\n';
+                else if (Value->Equal(str("\\0"))) ChunkDelimiter = '\0';
+                else if (Value->Equal(str("\\t"))) ChunkDelimiter = '\t';
+                else if (Value->Size == 1)          ChunkDelimiter = (u8)Value->Chars[0];
+                else {
+                    Printf(c_dim_red "[E]" c_grey " Expected one character (or \\n, \\0, \\t) for --chunk-delimiter" c_default "\n");
+                    Exit(0);
+                }
+                It += 1;
+            } else if (Arg->Equal(ArgHosts)) {
+                Options.Hosts = OptionValue(Args, Arg);
+                It += 1;
+            } else if (Arg->Equal(ArgLauncher)) {
+                Options.Launcher = OptionValue(Args, Arg);
+                It += 1;
+            } else if (Arg->Equal(ArgIn)) {
+                Roots.Push(OptionValue(Args, Arg));
+                It += 1;
+            } else if (Arg->Equal(ArgDeviceJobs)) {
+                DeviceLimit = (uint)MAX(OptionNumber(Arg, OptionValue(Args, Arg)), 1llu);
+                It += 1;
+            } else if (Arg->Equal(ArgOutput)) {
+                Options.Output = OptionValue(Args, Arg);
+                It += 1;
+            } else if (Arg->Equal(ArgTrace)) {
+                Options.Trace = OptionValue(Args, Arg);
+                It += 1;
+            } else if (Arg->Equal(ArgCache)) {
+                Options.Cache = OptionValue(Args, Arg);
+                It += 1;
+            } else if (Arg->Equal(ArgJobFile)) {
+                Options.JobFile = OptionValue(Args, Arg);
+                It += 1;
             } else if (Arg->StartsWith("--")) {
                 Printf("[E] Unknown command line argument: " FSTR "\n", (int)Arg->Size, Arg->Chars);
                 Exit(0);
             } else {
                 Options.ProgramToRun = Arg;
-                Commands = Args->SliceStartingWith(Arg+1);
+                if (Arg + 1 < &Args->Data[Args->Count]) Commands = Args->SliceStartingWith(Arg+1);
                 break;
             }
         }
     }
 
+    if (!Options.ProgramToRun && !Options.JobFile) {
+        Printf(c_dim_red "[E]" c_grey " No program to run." c_default "\n");
+        Exit(0);
+    }
+
+    if (Options.JobFile) {
+        const char *Conflict = Options.ProgramToRun ? "a program to run" : Options.Output ? "--output" : Options.Cache ? "--cache" :
+                               Concurrency.Auto ? "-j auto" : NULL;
+        if (Conflict) {
+            Printf(c_dim_red "[E]" c_grey " Cannot use --jobfile with %s (give it per job, if at all)." c_default "\n", Conflict);
+            Exit(0);
+        }
+    }
+
+    if (Options.Trace) {
+        TraceStart();
+        TraceName(TRACK_SCHEDULER, "fef");
+    }
+
+    if (Options.Cache && !Options.Output) {
+        Printf(c_dim_red "[E]" c_grey " --cache needs --output, to know what to keep." c_default "\n");
+        Exit(0);
+    }
+
+    if (Options.From && Roots.Count) {
+        Printf(c_dim_red "[E]" c_grey " Cannot use --from and --in together." c_default "\n");
+        Exit(0);
+    }
+
+    if (Options.From && (Options.Recursive || Options.IgnoreFiles)) {
+        Printf(c_dim_red "[E]" c_grey " --recursive and --ignore-files are about listing directories, not --from lists." c_default "\n");
+        Exit(0);
+    }
+
+    if (Options.FromArchive) {
+        const char *Conflict = Options.From ? "--from" : Roots.Count ? "--in" : Options.Recursive ? "--recursive" :
+                               Options.IgnoreFiles ? "--ignore-files" : Options.DeleteAfterwards ? "--del" :
+                               Options.DedupContent ? "--dedup-content" : Options.Cache ? "--cache" :
+                               Options.FollowSymlinks ? "--follow-symlinks" : Options.UniqueInodes ? "--unique-inodes" :
+                               Prefetch ? "--prefetch" : Options.DropCache ? "--drop-cache" : NULL;
+        if (Conflict) {
+            Printf(c_dim_red "[E]" c_grey " Cannot use --from-archive with %s (members are not files of their own)." c_default "\n", Conflict);
+            Exit(0);
+        }
+    }
+    bool FromList = Options.From || Options.FromArchive; // Not a directory listing.
+
+    // A chunk is a part of a file that other commands are still working on.
+    if (ChunkSize) {
+        const char *Conflict = Options.FromArchive ? "--from-archive" : Options.DeleteAfterwards ? "--del" :
+                               Options.DedupContent ? "--dedup-content" : Options.Cache ? "--cache" :
+                               Prefetch ? "--prefetch" : Options.DropCache ? "--drop-cache" : NULL;
+        if (Conflict) {
+            Printf(c_dim_red "[E]" c_grey " Cannot use --chunks with %s (they go by whole files)." c_default "\n", Conflict);
+            Exit(0);
+        }
+    }
+
+    if (!Options.DoFiles && !Options.DoDirs) {
+        Options.DoFiles = true;
+        Options.DoDirs  = true;
+    }
+
+    array<host> Hosts;
+    str LauncherPath;
+    bool SshLauncher = false; // Its 255 is a host's failure.
+    if (Options.Hosts) {
+        if (Concurrency.Auto) {
+            Printf(c_dim_red "[E]" c_grey " Cannot use -j auto with --hosts (it goes by this machine's load, not theirs)." c_default "\n");
+            Exit(0);
+        }
+        auto Launcher = Options.Launcher ? *Options.Launcher : str("ssh {host} --");
+        auto Text = str::Copy(Launcher.Chars, Launcher.Size); // Split in place.
+        auto Words = SplitWords(Text.Chars, Text.Chars + Text.Size);
+        if (Words.Count == 0) {
+            Printf(c_dim_red "[E]" c_grey " --launcher is empty." c_default "\n");
+            Exit(0);
+        }
+        usize Base = Words.Data[0].Size;
+        while (Base && Words.Data[0].Chars[Base - 1] != '/' && Words.Data[0].Chars[Base - 1] != '\\') Base -= 1;
+        auto LauncherName = str(Words.Data[0].Chars + Base, Words.Data[0].Size - Base);
+        SshLauncher = LauncherName.Equal(str("ssh")) || LauncherName.Equal(str("ssh.exe"));
+        Hosts = ParseHostFile(Options.Hosts, &Words);
+        Free(Words.Data);
+
+        uint Slots = 0;
+        foreach(Hosts) Slots += It->Slots;
+        if (!JobsGiven) Concurrency.Limit = Slots;
+    } else if (Options.Launcher) {
+        Printf(c_dim_red "[E]" c_grey " --launcher needs --hosts to run on." c_default "\n");
+        Exit(0);
+    }
+
+#if WIN_X64
+    Concurrency.Max = MIN(Concurrency.Max, (uint)MAXIMUM_WAIT_OBJECTS);
+#endif
+    Concurrency.Min = MIN(Concurrency.Min, Concurrency.Max);
+    if (Concurrency.Auto) {
+        Concurrency.Limit = MAX(Concurrency.Min, MIN(CpuCount(), Concurrency.Max));
+        if (!MemoryReserveGiven) Concurrency.MemoryReserve = MEGABYTES(256);
+    } else {
+        Concurrency.Max   = MAX(Concurrency.Limit, Concurrency.Max);
+        Concurrency.Limit = MIN(Concurrency.Limit, Concurrency.Max);
+    }
+    bool SamplePressure = Concurrency.Auto || Concurrency.MemoryReserve;
+
+    // Children we may have to kill get a process group of their own, so that whatever they
+    // started goes down with them.
+    Placement.NewProcessGroup = Timeout || Options.Speculate;
+    bool UsePlacement = Options.PinCores || Options.PinNuma || Placement.Nice || Placement.IoPriority != io_priority::Unchanged ||
+                        Placement.NewProcessGroup;
+
+    // With a job file every chain, stage 0 included, is fed through its queue by Dispatch.
+    bool Dispatching = Options.JobFile != NULL;
+    array<job> Jobs;
+    auto Stages = Dispatching ? array<stage>() : ParseStages(Options.ProgramToRun, Commands, Concurrency.Limit);
+    if (Dispatching) Jobs = ParseJobFile(Options.JobFile, &Stages, Concurrency.Limit);
+    uint SlotCount = Dispatching ? 0 : Concurrency.Max;
+    for (usize I = Dispatching ? 0 : 1; I < Stages.Count; ++I) SlotCount += Stages.Data[I].Limit;
+#if WIN_X64
+    if (SlotCount > MAXIMUM_WAIT_OBJECTS) {
+        Printf(c_dim_red "[E]" c_grey " Cannot run more than %d commands at once on Windows (all stages together)." c_default "\n", MAXIMUM_WAIT_OBJECTS);
+        Exit(0);
+    }
+#endif
+
+#if POSIX
+    // Forked now, while all we have is the command line: children forked from it do not pay
+    // for copying the page tables of the listing and everything else we allocate later.
+    if (!Options.DryRun && !Options.NoForkServer && !StartForkServer()) {
+        Printf(c_yellow "[W]" c_grey " Cannot start the fork server, forking children directly." c_default "\n");
+    }
+#endif
+
     //
-    // Check executable.
+    // Check executables.
     //
 
-    if (false && file_type::Invalid == FileType(Options.ProgramToRun)) {
-        Printf("[E] Cannot run \"" FSTR "\" (file does not exist).\n", (int)Options.ProgramToRun->Size, Options.ProgramToRun->Chars);
-        Exit(-1);
+    // Found once here instead of by execvp() for every child. With --hosts it is the
+    // launcher that runs here, the programs are for the hosts to find.
+    auto FindProgram = [&](str *Program, str *Path) {
+        *Path = FindExecutable(Program);
+        if (Path->Size == 0) {
+            if (Options.DryRun) {
+                Printf(c_yellow "[W]" c_grey " Cannot find \"" c_dim_yellow FSTR c_grey "\" (not a file, not executable or not in PATH)." c_default "\n",
+                    (int)Program->Size, Program->Chars);
+            } else {
+                Printf(c_dim_red "[E]" c_grey " Cannot run \"" c_dim_yellow FSTR c_grey "\" (not a file, not executable or not in PATH)." c_default "\n",
+                    (int)Program->Size, Program->Chars);
+                Exit(-1);
+            }
+        }
+    };
+    if (Hosts.Count) {
+        FindProgram(&Hosts.Data[0].Launcher.Data[0], &LauncherPath);
+    } else {
+        foreach(Stages) FindProgram(It->Program, &It->ProgramPath);
     }
 
     //
     // Tokenize command patterns.
     //
 
-    array<command_token> Tokens = TokenizeCommands(Commands);
+    foreach(Stages) {
+        It->Tokens = TokenizeCommands(It->Commands);
+        It->Stdin  = HasToken(&It->Tokens, token_STDIN);
+        if (It->Stdin && !Options.FromArchive) {
+            Printf(c_dim_red "[E]" c_grey " :stdin is for the members of --from-archive." c_default "\n");
+            Exit(0);
+        }
+    }
     array<str> TargetArgs;
-    TargetArgs.Push(str(Options.ProgramToRun->Chars, Options.ProgramToRun->Size));
+    array<str> HostArgs; // The launcher's, then the program and TargetArgs.
+    array<array<char>> ArgBuffers;
+
+#if POSIX
+    // Reused for every child: argv points into ArgBuffers, envp is our own environment.
+    array<char *> Argv;
+    char **Envp = Environment();
+#endif
 
     // Generate commands passed to the target program.
 
-    auto Files = ReadDirectory(Cwd);
+    throttle Throttle;
+    ThrottleInit(&Throttle, (double)MaxRate, (double)MaxIo);
+    auto IoThrottle = (MaxRate || MaxIo) ? &Throttle : NULL;
 
-    array<char> CommandString;
+    bool NeedsLength = false;
+    foreach(Stages) NeedsLength |= HasToken(&It->Tokens, token_LENGTH);
+    bool WithFileInfo = Shard.BySize || Options.DedupContent || Options.Output || MaxIo || Options.UniqueInodes || ChunkSize || NeedsLength;
+    bool NeedType = !Options.DoFiles || !Options.DoDirs || Prefetch || Options.DropCache || Options.Cache || // Only files are hinted or cached.
+                    Dispatching; // Jobs filter.
 
-    foreach(Files) {
-        auto File = It;
-        switch (File->Type) {
-            default: break;
+    array<command_token> OutputTokens;
+    if (Options.Output) OutputTokens = TokenizeCommands(slice<str>(Options.Output, 1));
+    if (HasToken(&OutputTokens, token_STDIN)) {
+        Printf(c_dim_red "[E]" c_grey " :stdin is not a name, --output cannot have it." c_default "\n");
+        Exit(0);
+    }
 
-            case file_type::File: {
-                // Printf("[F] "); PrintString(File->Name);
-            } break;
+    output_cache Cache;
+    Cache.Directory    = str();
+    Cache.Stages       = &Stages;
+    Cache.OutputTokens = &OutputTokens;
+    Cache.DryRun       = Options.DryRun;
+    cache_buffers CacheBuffers;
+    if (Options.Cache) {
+        if (!Options.DryRun && !MakeDirectory(Options.Cache)) {
+            Printf(c_dim_red "[E]" c_grey " Cannot make the cache directory \"" c_dim_yellow FSTR c_grey "\"" c_default "\n",
+                (int)Options.Cache->Size, Options.Cache->Chars);
+            Exit(0);
+        }
+        bool Separated = Options.Cache->EndsWith('/') || Options.Cache->EndsWith('\\');
+        Cache.Directory = Separated ? str::Copy(Options.Cache->Chars, Options.Cache->Size) : Options.Cache->Cat(PATH_SEPARATOR);
+    }
+
+    // With --from (--from-archive), entries are taken from the list (archive) as they are
+    // needed, unless something has to see all of them first (sharding by size, dedup,
+    // chunks): then it is read up front.
+    entry_list List;
+    archive Archive;
+    entry_pool Pool = {};
+    bool Streaming = false;
+    if (Options.From && !OpenEntryList(Options.From, &List)) {
+        Printf(c_dim_red "[E]" c_grey " Cannot read \"" c_dim_yellow FSTR c_grey "\"" c_default "\n",
+            (int)Options.From->Size, Options.From->Chars);
+        Exit(0);
+    }
+    if (Options.FromArchive && !OpenArchive(Options.FromArchive, &Archive)) {
+        Printf(c_dim_red "[E]" c_grey " Cannot read \"" c_dim_yellow FSTR c_grey "\" (it has to be a file, to be mapped)" c_default "\n",
+            (int)Options.FromArchive->Size, Options.FromArchive->Chars);
+        Exit(0);
+    }
 
-            case file_type::Directory: {
-                // Printf("[D] "); PrintString(File->Name);
+    // With --unique-inodes, the first name of anything listed under several: hard links, or
+    // anything reached through symbolic links as well. Only those with more than one link
+    // go in the set, unless links are followed.
+    inode_set Seen = {};
+    u64 SameInode = 0;
+    auto FirstName = [&](file *File) -> bool {
+        if (!Options.UniqueInodes || !File->Inode) return true;
+        if (File->Links < 2 && !Options.FollowSymlinks) return true;
+        if (InodeSetInsert(&Seen, File->FileSystem, File->Inode)) return true;
+        SameInode += 1;
+        return false;
+    };
 
-                str *ArgCursor = NULL;
+    // A listed name is not known to exist, or to be a file, until stat()-ed.
+    auto Listed = [&](file *File) -> bool {
+        if (!WithFileInfo && !NeedType) return true;
+        if (!StatFile(&File->Name, File, Options.FollowSymlinks)) {
+            Printf(c_yellow "[W]" c_grey " Cannot find \"" c_dim_yellow FSTR c_grey "\", skipping it." c_default "\n",
+                (int)File->Name.Size, File->Name.Chars);
+            return false;
+        }
+        return ((File->Type == file_type::File && Options.DoFiles) || (File->Type == file_type::Directory && Options.DoDirs)) &&
+               FirstName(File);
+    };
+
+    // The next entry of the list or the archive that is to be run on, NULL at its end.
+    auto NextListed = [&]() -> file * {
+        if (Options.FromArchive) {
+            archive_member Member;
+            while (NextArchiveMember(&Archive, &Member)) {
+                if (!(Member.Type == file_type::File ? Options.DoFiles : Options.DoDirs)) continue;
+                auto File = TakeEntry(&Pool, Member.Name);
+                File->Type   = Member.Type;
+                File->Size   = (usize)Member.Size;
+                File->Offset = Member.Offset;
+                File->ModifiedTime = Member.ModifiedTime;
+                return File;
+            }
+            return NULL;
+        }
+
+        str Name;
+        while (NextEntryName(&List, &Name)) {
+            auto File = TakeEntry(&Pool, Name);
+            if (Listed(File)) return File;
+            ReleaseEntry(&Pool, File);
+        }
+        return NULL;
+    };
+
+    listing_options ListingOptions = {};
+    ListingOptions.WithFileInfo = WithFileInfo;
+    ListingOptions.Recursive    = Options.Recursive;
+    ListingOptions.IgnoreFiles  = Options.IgnoreFiles;
+    ListingOptions.FollowSymlinks = Options.FollowSymlinks;
+    ListingOptions.UniqueInodes   = Options.UniqueInodes;
+    ListingOptions.Throttle     = IoThrottle;
+
+    array<file> Listing;
+    array<device> Devices;
+    if (Roots.Count) {
+        Devices = GroupRoots(&Roots);
+        if (Tracing) foreach(Devices) TraceName(TRACK_DEVICE(It->Index), "device", (int)It->Index);
+        Listing = ReadRoots(&Devices, &ListingOptions);
+    } else if (!FromList) {
+        u64 Begin = Tracing ? Nanoseconds() : 0;
+        Listing = ListDirectory(Cwd, &ListingOptions);
+        if (Tracing) TraceSpan("read directory", TRACK_SCHEDULER, Begin, Nanoseconds(), Cwd->Chars, Cwd->Size);
+    } else if (Shard.BySize || Options.DedupContent || ChunkSize) {
+        while (auto File = NextListed()) Listing.Push(File); // Kept for good.
+    } else {
+        Streaming = true;
+    }
+
+    array<file> Files(Listing.Count);
+    foreach(Listing) {
+        if (Options.Cache && It->Name.StartsWith(*Options.Cache)) { // Kept in the directory it caches.
+            usize Size = Options.Cache->Size;
+            if (It->Name.Size == Size || It->Name.Chars[Size] == '/' || Options.Cache->EndsWith('/')) continue;
+        }
+        if (IsTrash(&It->Name)) continue;
+        if (!FromList && !FirstName(It)) continue; // Listed() saw to the others.
+        if (FromList ||
+            (It->Type == file_type::File      && Options.DoFiles) ||
+            (It->Type == file_type::Directory && Options.DoDirs)) {
+            Files.Push(It);
+        }
+    }
+
+    if (ChunkSize) {
+        u64 Begin = Tracing ? Nanoseconds() : 0;
+        auto Chunks = SplitIntoChunks(&Files, ChunkSize, ChunkDelimiter);
+        if (Tracing) TraceSpan("chunks", TRACK_SCHEDULER, Begin, Nanoseconds());
+        Free(Files.Data);
+        Files = Chunks;
+    }
+
+    ApplyShard(&Files, &Shard);
+    if (Options.DedupContent) DedupContent(&Files, Options.DedupLink, Options.DryRun);
+
+    if (Options.Output && !Streaming) {
+        // A list is not a directory: its outputs get a stat() each.
+        name_index ListingIndex = {};
+        if (!FromList) ListingIndex = BuildNameIndex(&Listing);
+        SkipUpToDate(&Files, &OutputTokens, FromList ? NULL : &ListingIndex);
+        Free(ListingIndex.Slots);
+    }
+
+    // --del: out of the way now, removed in the background.
+    trash Trash = {};
+    if (Options.DeleteAfterwards && !Options.DryRun) {
+        StartTrash(&Trash, IoThrottle);
+        if (Roots.Count) {
+            foreach(Devices) {
+                auto Device = It;
+                foreach(Device->Roots) TrashBin(&Trash, *It);
+            }
+        } else if (!FromList) {
+            TrashBin(&Trash, str((char *)"", 0));
+        }
+    }
+    removal_order Order = {};
+    bool Ordered = Options.Recursive && Options.DeleteAfterwards && !Options.DryRun;
+    if (Ordered) StartRemovalOrder(&Order, &Files);
+    array<file *> Ready;
+    auto Remove = [&](file *File) {
+        Ready.Reset();
+        if (Ordered) ReadyForRemoval(&Order, File, &Ready);
+        else         Ready.Push(File);
+        foreach(Ready) {
+            u64 Begin = Tracing ? Nanoseconds() : 0;
+            ThrowAway(&Trash, *It);
+            if (Tracing) TraceSpan("trash", TRACK_SCHEDULER, Begin, Nanoseconds(), (*It)->Name.Chars, (*It)->Name.Size);
+        }
+    };
+
+    // Restored from the cache: done as if they had run.
+    u64 RestoredCount = 0;
+    auto Restoring = [&](file *File) {
+        RestoredCount += 1;
+        if (Options.Verbose || Options.DryRun) {
+            Printf(c_grey "restoring output of \"" c_dim_yellow FSTR c_grey "\" from the cache..." c_default "\n",
+                (int)File->Name.Size, File->Name.Chars);
+        }
+        if (Options.DeleteAfterwards && !Options.DryRun) Remove(File);
+    };
+
+    // Side arrays of what file leaves to the options that need it, one per entry of Files
+    // (a streamed entry carries its own, see listed_entry).
+    array<cache_key> Keys; // With --cache.
+    array<uint> JobsLeft;  // With --jobfile.
+    array<uint> HostFailures; // With --hosts.
+    if (Cache.Directory.Size && !Streaming) {
+        array<file> Restored;
+        RestoreCached(&Cache, &Files, &Restored, &Keys);
+        foreach(Restored) Restoring(It);
+        Free(Restored.Data);
+    }
+
+    // Stage 0 then takes turns between devices.
+    if (Devices.Count) SplitByDevice(&Files, &Devices, &Keys);
+    if (Dispatching && !Streaming) {
+        JobsLeft = array<uint>(Files.Count);
+        JobsLeft.PushCount(Files.Count); // Set as each is handed out.
+    }
+    if (Hosts.Count && !Streaming) {
+        HostFailures = array<uint>(Files.Count);
+        for (usize I = 0; I < Files.Count; ++I) HostFailures.Push((uint)0);
+    }
+    auto KeyOf = [&](file *File) -> cache_key * {
+        return Streaming ? &((listed_entry *)File)->Key : &Keys.Data[File - Files.Data];
+    };
+    auto JobsLeftOf = [&](file *File) -> uint * {
+        return Streaming ? &((listed_entry *)File)->Jobs : &JobsLeft.Data[File - Files.Data];
+    };
+    auto HostFailuresOf = [&](file *File) -> uint * {
+        return Streaming ? &((listed_entry *)File)->HostFailures : &HostFailures.Data[File - Files.Data];
+    };
+    usize NextDevice = 0;
+
+    // Stage 0 takes entries from Files, or straight from the list when streaming.
+    usize NextFile = 0;
+    file *Upcoming = NULL; // Taken but not started yet.
+    array<file *> Retries; // Stage 0 entries a host could not run, for another one.
+    u64 UpToDate = 0;
+    array<array<char>> OutputBuffers;
+    array<str> OutputArgs;
+
+    auto PeekInput = [&]() -> file * {
+        if (Upcoming) return Upcoming;
+        for (usize I = Retries.Count; I-- > 0;) { // Held by a device at its limit like the rest.
+            auto File = Retries.Data[I];
+            if (Devices.Count && DeviceLimit && Devices.Data[File->Device].Running >= DeviceLimit) continue;
+            Retries.Data[I] = Retries.Data[--Retries.Count];
+            return Upcoming = File;
+        }
+        if (!Streaming && Devices.Count) {
+            for (usize I = 0; I < Devices.Count && !Upcoming; ++I) {
+                auto Device = &Devices.Data[(NextDevice + I) % Devices.Count];
+                if (Device->Next == Device->End || (DeviceLimit && Device->Running >= DeviceLimit)) continue;
+                Upcoming = &Files.Data[Device->Next++];
+                NextDevice = Device->Index + 1;
+            }
+            return Upcoming;
+        }
+        if (!Streaming) {
+            if (NextFile < Files.Count) Upcoming = &Files.Data[NextFile++];
+            return Upcoming;
+        }
+
+        file *File;
+        while (!Upcoming && (File = NextListed())) {
+            bool Take = true;
+            if (Take && Shard.Count > 1) {
+                Take = HashToRange(ShardHash(File), Shard.Count) == Shard.Index;
+            }
+            if (Take && Options.Output && IsUpToDate(File, &OutputTokens, NULL, &OutputBuffers, &OutputArgs)) {
+                UpToDate += 1;
+                Take = false;
+            }
+            if (Take && Cache.Directory.Size && RestoreFromCache(&Cache, File, KeyOf(File), &CacheBuffers)) {
+                Restoring(File);
+                Take = false;
+            }
+            if (Take) Upcoming = File;
+            else      ReleaseEntry(&Pool, File);
+        }
+        return Upcoming;
+    };
+
+    // Called once an entry is done with, whichever way.
+    auto Finish = [&](file *File) {
+        if (Streaming) ReleaseEntry(&Pool, File);
+    };
+
+    // Keeps the page cache Prefetch files ahead of stage 0 (a list that is streamed is not
+    // known ahead of time). Files[Next, Prefetched) have been asked for.
+    usize Prefetched = 0;
+    auto PrefetchRange = [&](usize Next, usize *Cursor, usize End) {
+        usize Until = MIN(Next + Prefetch, End);
+        for (usize I = MAX(*Cursor, Next); I < Until; ++I) {
+            if (Files.Data[I].Type == file_type::File) AdviseFile(&Files.Data[I].Name, file_advice::WillNeed);
+        }
+        *Cursor = MAX(*Cursor, Until);
+    };
+    auto PrefetchAhead = [&]() {
+        if (!Prefetch || Streaming || Options.DryRun) return;
+        if (Devices.Count) {
+            foreach(Devices) PrefetchRange(It->Next, &It->Prefetched, It->End);
+        } else {
+            PrefetchRange(NextFile, &Prefetched, Files.Count);
+        }
+    };
+
+    for (usize I = Dispatching ? 0 : 1; I < Stages.Count; ++I) Stages.Data[I].Queue = array<file *>(Streaming ? SlotCount : Files.Count);
+
+    array<slot> Slots(SlotCount);
+    for (uint I = 0; I < SlotCount; ++I) {
+        auto Slot = Slots.Push();
+        *Slot = {};
+        Slot->Command = array<char>();
+        if (Tracing) TraceName(TRACK_SLOT(I), "slot", (int)I);
+    }
+    uint Running = 0;
+    bool Failed  = false;
+
+    // A dry run is all echo, and a progress line only makes sense on a terminal.
+    bool Echo = Options.Verbose || Options.DryRun;
+    progress Progress = {};
+    if (!Options.DryRun && StderrIsTerminal()) StartProgress(&Progress, Streaming ? 0 : Files.Count);
+
+    // The host with the most free slots, taking turns between equals. NULL if all are busy
+    // (or out).
+    usize NextHost = 0;
+    auto PickHost = [&]() -> host * {
+        host *Best = NULL;
+        for (usize I = 0; I < Hosts.Count; ++I) {
+            auto Host = &Hosts.Data[(NextHost + I) % Hosts.Count];
+            if (Host->Out || Host->Running >= Host->Slots) continue;
+            if (!Best || Host->Slots - Host->Running > Best->Slots - Best->Running) Best = Host;
+        }
+        if (Best) NextHost = (usize)(Best - Hosts.Data) + 1;
+        return Best;
+    };
+
+    auto HostFree = [&]() -> bool {
+        if (!Hosts.Count) return true;
+        foreach(Hosts) if (!It->Out && It->Running < It->Slots) return true;
+        return false;
+    };
+
+    auto Launch = [&](slot *Slot, stage *Stage, file *File) -> bool {
+        int SlotIndex = (int)(Slot - Slots.Data);
+        host *Host = NULL;
+        if (Hosts.Count && !(Host = PickHost())) return false;
+
+        u64 TraceBegin = Tracing ? Nanoseconds() : 0;
+        ExpandCommand(&Stage->Tokens, File, &ArgBuffers, &TargetArgs);
+
+        // Through a launcher, the program and its arguments are arguments of the launcher.
+        auto Program     = Stage->Program;
+        auto ProgramPath = &Stage->ProgramPath;
+        auto ProgramArgs = &TargetArgs;
+        if (Host) {
+            HostArgs.Reset();
+            for (usize I = 1; I < Host->Launcher.Count; ++I) HostArgs.Push(Host->Launcher.Data[I]);
+            HostArgs.Push(*Stage->Program);
+            foreach(TargetArgs) HostArgs.Push(*It);
+            Program     = &Host->Launcher.Data[0];
+            ProgramPath = &LauncherPath;
+            ProgramArgs = &HostArgs;
+        }
+
+        auto CommandString = &Slot->Command;
+        BuildCommandString(CommandString, Program, ProgramArgs);
+        if (Tracing) TraceSpan("expand", TRACK_SLOT(SlotIndex), TraceBegin, Nanoseconds(), File->Name.Chars, File->Name.Size);
+
+        if (Echo) {
+            Printf(c_grey "running " c_cyan FSTR c_grey "..." c_default "\n",
+                (int)CommandString->Count - 1, CommandString->Data);
+        }
+
+        if (Options.DryRun) return true;
+
+        // Slots, not entries, go round-robin so running children never share a core
+        // (as long as there are at least as many cores as slots).
+        if (Options.PinCores) Placement.Cpu      = SlotIndex;
+        if (Options.PinNuma)  Placement.NumaNode = SlotIndex;
+        auto SpawnOptions = UsePlacement ? &Placement : NULL;
+        TraceBegin = Tracing ? Nanoseconds() : 0;
+#if POSIX
+        // Its own pipe for every child, a speculative copy's too.
+        spawn_options Streamed;
+        int Stdin = -1;
+        if (Stage->Stdin) {
+            Stdin = StreamToPipe(Archive.Handle, Archive.Map.Data, File->Offset, File->Size);
+            if (Stdin < 0) {
+                Printf(c_dim_red "[E]" c_grey " Cannot make a pipe for " c_cyan FSTR c_grey "\n",
+                    (int)CommandString->Count - 1, CommandString->Data);
+                return false;
+            }
+            Streamed = Placement;
+            Streamed.Stdin = Stdin;
+            SpawnOptions = &Streamed;
+        }
+
+        Argv.Reset();
+        Argv.Push(Program->Chars);
+        foreach(*ProgramArgs) Argv.Push(It->Chars);
+        Argv.Push((char *)NULL);
+        process_id Process = SpawnProcess(ProgramPath->Chars, Argv.Data, Envp, SpawnOptions);
+        if (Stdin >= 0) CloseInput(Stdin); // The child's now.
+#elif WIN_X64
+        auto CommandStr = str(CommandString->Data, CommandString->Count - 1);
+        process_id Process = SpawnProcess(&CommandStr, SpawnOptions, ProgramPath);
+#endif
+        if (Process == INVALID_PROCESS) {
+            Printf(c_dim_red "[E]" c_grey " Failed to run " c_cyan FSTR c_grey "\n",
+                (int)CommandString->Count - 1, CommandString->Data);
+            return false;
+        }
+
+        auto Command = Slot->Command;
+        *Slot = {};
+        Slot->Command = Command;
+        Slot->Busy    = true;
+        Slot->Process = Process;
+        Slot->File    = File;
+        Slot->Stage   = Stage;
+        Slot->Host    = Host;
+        Slot->Started = Nanoseconds();
+        // Until fork() (CreateProcess()) returns in here: exec() is the child's, in its "run".
+        if (Tracing) TraceSpan("spawn", TRACK_SLOT(SlotIndex), TraceBegin, Slot->Started, File->Name.Chars, File->Name.Size);
+        Stage->Running += 1;
+        Running += 1;
+        if (Devices.Count) Devices.Data[File->Device].Running += 1;
+        if (Host) Host->Running += 1;
+        __atomic_store_n(&Progress.Running, (u64)Running, __ATOMIC_RELAXED);
+        return true;
+    };
+
+    auto Pending = [&](stage *Stage) -> usize {
+        if (Stage == Stages.Data && !Dispatching) return PeekInput() ? 1 : 0;
+        return Stage->Queue.Count - Stage->Next;
+    };
+
+    // While streaming, an earlier stage waits for a later one that has fallen this many
+    // rounds behind, instead of piling up entries in between.
+    auto Backlogged = [&](stage *Stage) -> bool {
+        return Streaming && !Stage->Last && Pending(Stage + 1) >= STREAM_BACKLOG_ROUNDS * (Stage + 1)->Limit;
+    };
+
+    // An entry is done with once every job it went to is (there is just the one without
+    // --jobfile): true for the last of them.
+    auto LastJob = [&](file *File) -> bool {
+        return !Dispatching || --*JobsLeftOf(File) == 0;
+    };
+
+    // Hands entries to the jobs that want them while one of those is short of work, but
+    // not while another has this many rounds of it queued: the slowest job sets the pace,
+    // as a later stage does for an earlier one.
+    // True if it handed out any.
+    auto Dispatch = [&]() -> bool {
+        bool Handed = false;
+        while (Dispatching && !Failed) {
+            bool Short = false;
+            foreach(Jobs) {
+                auto First = &Stages.Data[It->FirstStage];
+                usize Queued = Pending(First);
+                if (Queued >= STREAM_BACKLOG_ROUNDS * First->Limit) return Handed;
+                Short |= Queued < First->Limit;
+            }
+            if (!Short) return Handed;
+
+            auto File = PeekInput();
+            if (!File) return Handed;
+            Upcoming = NULL;
+            Handed   = true;
+
+            auto Left = JobsLeftOf(File);
+            *Left = 0;
+            foreach(Jobs) {
+                if (!JobTakes(It, File)) continue;
+                Stages.Data[It->FirstStage].Queue.Push(File);
+                *Left += 1;
+            }
+            if (*Left == 0) {
+                __atomic_add_fetch(&Progress.Done, 1, __ATOMIC_RELAXED);
+                Finish(File);
+            }
+        }
+        return Handed;
+    };
+
+    // Entries stage 0 cannot start yet only because their device is at its limit.
+    auto HeldByDevice = [&]() -> bool {
+        if (Devices.Count && Retries.Count) return true;
+        foreach(Devices) if (It->Next < It->End) return true;
+        return false;
+    };
+
+    // Nothing more will be started in Stage: the queue is empty and nothing before it runs.
+    auto Drained = [&](stage *Stage) -> bool {
+        if (HeldByDevice() || (Dispatching && PeekInput())) return false;
+        for (auto It = Stage - Stage->Depth; It <= Stage; ++It) {
+            if (Pending(It) || (It < Stage && It->Running)) return false;
+        }
+        return true;
+    };
+
+    auto AllDrained = [&]() -> bool {
+        foreach(Stages) if (It->Last && !Drained(It)) return false;
+        return true;
+    };
+
+    auto Removing = [&](file *File) {
+        if (Echo) {
+            Printf(c_grey "Removing \"" c_dim_yellow FSTR c_grey "\"..." c_default "\n",
+                (int)File->Name.Size, File->Name.Chars);
+        }
+    };
 
-                foreach(Tokens) {
-                    switch (It->Type) {
-                        case token_NEW_COMMAND: {
-                            str NewStr;
-                            NewStr.Chars = MallocCount<char>(9999);
-                            NewStr.Size  = 0;
-                            ArgCursor = TargetArgs.Push(NewStr);
-                        } break;
+    for (;;) {
+        u64 Now = Nanoseconds();
+        if (!Dispatching) {
+            if (SamplePressure) UpdateConcurrency(&Concurrency, Stages.Data[0].Running, Now);
+            Stages.Data[0].Limit = Concurrency.Limit;
+        }
+        bool Moved = Dispatch(); // Or took an entry on in a stage (all a dry run does).
 
-                        case token_NAME: {
-                            ArgCursor->Append(str(File->Name.Chars, File->Name.Size));
-                        } break;
+        //
+        // Start as many commands as we are allowed to, later stages first so entries
+        // already under way get through.
+        //
 
-                        case token_COLON: {
-                            ArgCursor->Append(':');
-                        } break;
+        u64 ThrottleDelay_ = 0;
+        for (usize StageIndex = Stages.Count; StageIndex-- > 0 && !ThrottleDelay_;) {
+            auto Stage = &Stages.Data[StageIndex];
+            while (!Failed && !Concurrency.MemoryHold && Stage->Running < Stage->Limit && !Backlogged(Stage) && HostFree() && Pending(Stage)) {
+                bool FromInput = StageIndex == 0 && !Dispatching;
+                auto File = FromInput ? PeekInput() : Stage->Queue.Data[Stage->Next];
+                if (IoThrottle && !Options.DryRun) {
+                    ThrottleDelay_ = ThrottleDelay(IoThrottle, 1, Stage->Depth ? 0 : File->Size);
+                    if (ThrottleDelay_) break;
+                }
+                Moved = true;
+                if (FromInput) {
+                    Upcoming = NULL;
+                } else if (++Stage->Next == Stage->Queue.Count) {
+                    Stage->Queue.Reset();
+                    Stage->Next = 0;
+                }
 
-                        case token_TEXT: {
-                            ArgCursor->Append(It->Str);
-                        } break;
+                if (Options.DryRun) {
+                    // Nothing runs, so nothing would move it along: echo the whole chain.
+                    for (auto It = Stage;; ++It) {
+                        Launch(&Slots.Data[0], It, File);
+                        if (It->Last) break;
+                    }
+                    if (LastJob(File)) {
+                        if (Options.DeleteAfterwards) Removing(File);
+                        Finish(File);
                     }
+                    continue;
                 }
 
-                foreach(TargetArgs) {
-                    bool NeedsQuotes = It->Contains(' ');
-                    if (NeedsQuotes) CommandString.Push('"');
+                slot *Slot = NULL;
+                foreach(Slots) if (!It->Busy) { Slot = It; break; }
+                assert0(Slot != NULL);
 
-                    for (char *C = It->Chars, *End = &It->Chars[It->Size]; C < End; ++C) {
-                        CommandString.Push(C);
+                if (!Launch(Slot, Stage, File)) Failed = true;
+            }
+        }
+
+        PrefetchAhead();
+
+        //
+        // Stop the ones over time and copy the stragglers, and see when that is next due.
+        //
+
+        u64 NextDeadline = WAIT_FOREVER;
+        if (Timeout || Options.Speculate) {
+            Now = Nanoseconds();
+            foreach(Slots) {
+                if (!It->Busy || It->Cancelled) continue;
+                auto Stage = It->Stage;
+                u64 Runtime = Now - It->Started;
+                u64 Deadline = WAIT_FOREVER;
+
+                if (Timeout) {
+                    if (!It->TimedOut && Runtime >= Timeout) {
+                        KillProcess(It->Process, false);
+                        It->TimedOut = true;
+                    } else if (It->TimedOut && !It->Killed && Runtime >= Timeout + TIMEOUT_KILL_GRACE) {
+                        KillProcess(It->Process, true);
+                        It->Killed = true;
                     }
+                    if      (!It->TimedOut) Deadline = It->Started + Timeout;
+                    else if (!It->Killed)   Deadline = It->Started + Timeout + TIMEOUT_KILL_GRACE;
+                }
 
-                    if (NeedsQuotes) CommandString.Push('"');
-                    CommandString.Push(' ');
+                bool Speculating = Options.Speculate && !Failed && Stage->Median && Drained(Stage);
+                if (Speculating && !It->Speculative && !It->Twin && !It->TimedOut) {
+                    u64 Straggling = SPECULATE_FACTOR * Stage->Median;
+                    if (Runtime >= Straggling && Stage->Running < Stage->Limit) {
+                        auto Straggler = It;
+                        slot *Copy = NULL;
+                        foreach(Slots) if (!It->Busy) { Copy = It; break; }
+                        if (Copy && Launch(Copy, Stage, Straggler->File)) {
+                            Copy->Speculative = true;
+                            Copy->Twin      = Straggler;
+                            Straggler->Twin = Copy;
+                            if (Timeout) NextDeadline = MIN(NextDeadline, Copy->Started + Timeout);
+                        }
+                    } else if (Runtime < Straggling) {
+                        Deadline = MIN(Deadline, It->Started + Straggling);
+                    }
                 }
-                assert0(CommandString.Count > 0);
-                CommandString.Count -= 1;
-                CommandString.Push('\0');
 
-                Printf(c_grey "running " c_cyan FSTR c_grey "..." c_default "\n",
-                    (int)CommandString.Count, CommandString.Data);
+                NextDeadline = MIN(NextDeadline, Deadline);
+            }
+        }
 
-                if (!Options.DryRun) {
-                    auto CommandStr = str(CommandString.Data);
-#if MACINTOSH_X64
-                    int ExitCode = RunCommandLineProgram(TargetArgs);
-#elif WIN_X64
-                    int ExitCode = RunCommandLineProgram(&CommandStr);
-#endif
-                    if (ExitCode != 0) {
-                        Printf(c_dim_red "[E]" c_grey " Failed to run " c_cyan FSTR c_grey "\n",
-                            (int)CommandStr.Size, CommandStr.Chars);
-                        Exit(0);
+        //
+        // Wait for one of them to finish.
+        //
+
+        if (Running == 0) {
+            if (Failed || AllDrained()) break;
+            // Nothing running, as in a dry run: go on while that gets anywhere.
+            if (Moved && !ThrottleDelay_) continue;
+            // Nothing running and not allowed to start anything: wait out the throttle or
+            // the memory hold.
+            FlushOutput();
+            SleepNanoseconds(ThrottleDelay_ ? ThrottleDelay_ : PRESSURE_SAMPLE_INTERVAL);
+            continue;
+        }
+
+        Now = Nanoseconds();
+        u64 WaitTimeout = WAIT_FOREVER;
+        if (SamplePressure) {
+            WaitTimeout = (Concurrency.NextSample > Now) ? Concurrency.NextSample - Now : 0;
+        }
+        if (ThrottleDelay_) WaitTimeout = MIN(WaitTimeout, ThrottleDelay_);
+        if (NextDeadline != WAIT_FOREVER) WaitTimeout = MIN(WaitTimeout, (NextDeadline > Now) ? NextDeadline - Now : 0);
+
+        process_id Finished;
+        int ExitCode;
+        FlushOutput();
+        u64 WaitBegin = Tracing ? Nanoseconds() : 0;
+        bool Reaped = WaitForAnyProcess(&Finished, &ExitCode, WaitTimeout);
+        u64 WaitEnd = Tracing ? Nanoseconds() : 0;
+        if (Tracing) TraceSpan("wait", TRACK_SCHEDULER, WaitBegin, WaitEnd);
+        if (!Reaped) continue;
+
+        slot *Slot = NULL;
+        foreach(Slots) if (It->Busy && It->Process == Finished) { Slot = It; break; }
+        if (!Slot) continue; // Not one of ours.
+
+        // Named after the program, so stages tell apart.
+        if (Tracing) TraceSpan(Slot->Stage->Program->Chars, TRACK_SLOT(Slot - Slots.Data), Slot->Started, WaitEnd,
+                               Slot->File->Name.Chars, Slot->File->Name.Size);
+
+        auto Stage = Slot->Stage;
+        Slot->Busy = false;
+        Stage->Running -= 1;
+        Running -= 1;
+        if (Devices.Count) Devices.Data[Slot->File->Device].Running -= 1;
+        if (Slot->Host) Slot->Host->Running -= 1;
+        __atomic_store_n(&Progress.Running, (u64)Running, __ATOMIC_RELAXED);
+
+        if (Slot->Cancelled) continue;
+
+        bool Succeeded = (ExitCode == 0 && !Slot->TimedOut);
+        if (auto Host = Slot->Host) {
+            if (ExitCode == LAUNCHER_FAILED && SshLauncher && !Slot->TimedOut) {
+                // The host's failure, not the entry's: it goes to another one, unless it
+                // has had as many tries as there are hosts.
+                if (++Host->Failures >= HOST_FAILURE_LIMIT && !Host->Out) {
+                    Host->Out = true;
+                    Printf(c_yellow "[W]" c_grey " Leaving out host \"" c_dim_yellow FSTR c_grey "\" after %u failures to launch in a row." c_default "\n",
+                        (int)Host->Name.Size, Host->Name.Chars, Host->Failures);
+                    bool Left = false;
+                    foreach(Hosts) Left |= !It->Out;
+                    if (!Left) {
+                        Printf(c_dim_red "[E]" c_grey " No hosts left to run on." c_default "\n");
+                        Failed = true;
                     }
                 }
-                CommandString.Reset();
-
-                if (Options.DeleteAfterwards) {
-                    Printf(c_grey "Removing \"" c_dim_yellow FSTR c_grey "\"..." c_default "\n",
-                        (int)File->Name.Size, File->Name.Chars);
-                    if (!Options.DryRun)
-                        Delete(&File->Name);
+                if (!Failed && !Slot->Twin && ++*HostFailuresOf(Slot->File) < Hosts.Count) {
+                    if (Stage == Stages.Data && !Dispatching) Retries.Push(Slot->File);
+                    else                                      Stage->Queue.Push(Slot->File);
+                    continue;
                 }
+            } else if (Succeeded) {
+                Host->Failures = 0;
+            }
+        }
+        if (auto Twin = Slot->Twin) {
+            Twin->Twin = NULL;
+            if (!Succeeded) continue; // Leave it to the other copy.
+            KillProcess(Twin->Process, true);
+            Twin->Cancelled = true;
+        }
 
-                TargetArgs.Count = 1;
-            } break;
+        if (!Succeeded) {
+            __atomic_add_fetch(&Progress.Done, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&Progress.Failed, 1, __ATOMIC_RELAXED);
+            Printf(c_dim_red "[E]" c_grey " %s " c_cyan FSTR c_grey "\n", Slot->TimedOut ? "Timed out" : "Failed to run",
+                (int)Slot->Command.Count - 1, Slot->Command.Data);
+            Failed = true;
+            if (LastJob(Slot->File)) Finish(Slot->File);
+            continue;
+        }
+
+        if (Options.Speculate) {
+            Stage->Runtimes.Push(Nanoseconds() - Slot->Started);
+            if (Stage->Runtimes.Count >= SPECULATE_MIN_COMPLETED) Stage->Median = MedianRuntime(&Stage->Runtimes);
+        }
+
+        if (!Stage->Last) {
+            (Stage + 1)->Queue.Push(Slot->File);
+            continue;
+        }
+        if (!LastJob(Slot->File)) continue;
+
+        __atomic_add_fetch(&Progress.Done, 1, __ATOMIC_RELAXED);
+        if (Cache.Directory.Size) StoreInCache(&Cache, Slot->File, KeyOf(Slot->File), &CacheBuffers);
+        if (Options.DeleteAfterwards) {
+            Removing(Slot->File);
+            Remove(Slot->File);
+        } else if (Options.DropCache && Slot->File->Type == file_type::File) {
+            AdviseFile(&Slot->File->Name, file_advice::DontNeed);
         }
+        Finish(Slot->File);
+    }
+
+    if (UpToDate) Printf(c_grey "Skipped " FU64 " up to date entries." c_default "\n", UpToDate);
+    if (SameInode) Printf(c_grey "Skipped " FU64 " more names of entries already listed." c_default "\n", SameInode);
+    if (RestoredCount) Printf(c_grey "Restored " FU64 " outputs from the cache." c_default "\n", RestoredCount);
+    if (Options.From) CloseEntryList(&List);
+
+    StopProgress(&Progress);
+    StopTrash(&Trash);
+    if (Options.Trace && !TraceWrite(Options.Trace)) {
+        Printf(c_dim_red "[E]" c_grey " Cannot write the trace to \"" c_dim_yellow FSTR c_grey "\"" c_default "\n",
+            (int)Options.Trace->Size, Options.Trace->Chars);
     }
+    if (Failed) Exit(0);
 }
 
-#if (MACINTOSH_X64) // ------------------------------------------------------------------
+#if (POSIX) // --------------------------------------------------------------------------
 int main(int ArgsCount, char **Args) {
     array<str> Arguments = array<str>(ArgsCount - 1);
     for (auto It = Args+1, End = &Args[ArgsCount]; It < End; ++It) {
@@ -253,6 +3471,10 @@ int main(int ArgsCount, char **Args) {
 
     Main(&Arguments, &Exe, &Cwd);
 
+#if DEBUG_ALLOCATIONS
+    if (AllocationReportAtExit) allocation_report();
+#endif
+    FlushOutput();
     return 0;
 }
 #elif (WIN_X64) // ----------------------------------------------------------------------
@@ -269,6 +3491,10 @@ int wmain(int ArgsCount, wchar_t *Args[]) {
 
     Main(&Arguments, &Exe, &Cwd);
 
+#if DEBUG_ALLOCATIONS
+    if (AllocationReportAtExit) allocation_report();
+#endif
+    FlushOutput();
     TerminalCleanup();
     return 0;
 }
@@ -2,9 +2,11 @@
 #define PLATFORM_H
 
 #include "common.h"
+#include <inttypes.h>
 
-#define FU64 "%llu"
-#define FS64 "%lld"
+// u64/s64 are "unsigned long" on Linux but "unsigned long long" elsewhere; these follow them.
+#define FU64 "%" PRIu64
+#define FS64 "%" PRId64
 #define FSTR "%.*s"
 
 namespace file_type {
@@ -18,7 +20,14 @@ enum file_type {
 struct file {
     str Name;
     usize Size;
+    u64 ModifiedTime; // Nanoseconds, only comparable with other times on this platform.
+    u64 FileSystem;   // st_dev and st_ino, 0 unless stat()-ed (always on Windows).
+    u64 Inode;
+    u64 Offset;       // Where its content starts: in the archive with --from-archive, in the file with --chunks.
     enum file_type::file_type Type;
+    uint Device;      // Group it was listed in with --in (an index of Main's), 0 otherwise.
+    uint Links;       // Hard links to it, 0 unless stat()-ed.
+    uint Chunk;       // With --chunks, which of its file's it is.
 };
 
 void Exit(int ExitCode);
@@ -27,13 +36,54 @@ void Exit(int ExitCode);
 void *Malloc_(usize Size, char *CallerName);
 void Free(void * Memory);
 file_type::file_type FileType(str *Path);
-void Delete(str *Path);
+void Delete(str *Path, throttle *Throttle = NULL); // One operation per file or directory removed.
+bool MakeDirectory(str *Path); // True if it is there afterwards, whoever made it.
+bool RenamePath(str *Path, str *NewPath); // A file or a whole directory, at once. Fails across file systems.
 str GetCwd();
 
+typedef s64 process_id; // "pid_t" on POSIX, "HANDLE" on Windows.
+#define INVALID_PROCESS ((process_id)-1)
+#define WAIT_FOREVER    ((u64)-1)
+
+namespace io_priority {
+enum io_priority {
+    Unchanged,
+    BestEffort, // Lowest best-effort level.
+    Idle        // Only gets disk time nobody else wants.
+};
+}
+
+// Applied to the child before it runs the target program.
+struct spawn_options {
+    int Cpu;      // Pin to this index into the CPUs we may run on, -1 to not pin.
+    int NumaNode; // Bind CPUs and memory to this index into online NUMA nodes, -1 to not bind.
+    int Nice;     // Added to the child's nice value.
+    io_priority::io_priority IoPriority;
+    bool NewProcessGroup; // So KillProcess() gets everything the child started too.
+    int Stdin;            // Descriptor the child gets as standard input, 0 to keep ours (POSIX).
+};
+
 #if (__APPLE__ && __MACH__ && __x86_64__) // ---------------------------------------------
     // MacOS x64.
     #define MACINTOSH_X64 1
+    #define POSIX 1
+    int RunCommandLineProgram(array<str> Command);
+    process_id SpawnProcess(array<str> *Command, spawn_options *Options = NULL);
+    process_id SpawnProcess(char *Path, char **Argv, char **Envp, spawn_options *Options = NULL);
+    char ** Environment();
+    bool StartForkServer(); // Call before anything big is allocated, see platform_posix.cpp.
+    int StreamToPipe(s64 File, u8 *Data, u64 Offset, u64 Size); // See platform_posix.cpp.
+
+#elif (__linux__ && __x86_64__) // -------------------------------------------------------
+    // Linux x64.
+    #define LINUX_X64 1
+    #define POSIX 1
     int RunCommandLineProgram(array<str> Command);
+    process_id SpawnProcess(array<str> *Command, spawn_options *Options = NULL);
+    process_id SpawnProcess(char *Path, char **Argv, char **Envp, spawn_options *Options = NULL);
+    char ** Environment();
+    bool StartForkServer(); // Call before anything big is allocated, see platform_posix.cpp.
+    int StreamToPipe(s64 File, u8 *Data, u64 Offset, u64 Size); // See platform_posix.cpp.
 
 #elif (_WIN64) // ------------------------------------------------------------------------
     // Windows x64.
@@ -50,17 +100,81 @@ str GetCwd();
     strw GetCwdW();
     void TerminalInit();
     void TerminalCleanup();
+    process_id SpawnProcess(str *Command, spawn_options *Options = NULL, str *Application = NULL);
 #else // ---------------------------------------------------------------------------------
     #error "Unsupported platform."
 #endif // --------------------------------------------------------------------------------
 
-array<file> ReadDirectory(str &Directory, bool GetFileSizes = false);
-array<file> ReadDirectory(str *Directory, bool GetFileSizes = false);
+// Size, ModifiedTime and the inode fields are 0 unless WithFileInfo is set (except on
+// Windows, where the first two come for free). Throttle is charged one operation per entry
+// stat()-ed, plus one. A symbolic link is neither a file nor a directory unless
+// FollowSymlinks is set, then it is what it points to (every entry is stat()-ed).
+array<file> ReadDirectory(str &Directory, bool WithFileInfo = false, throttle *Throttle = NULL, bool FollowSymlinks = false);
+array<file> ReadDirectory(str *Directory, bool WithFileInfo = false, throttle *Throttle = NULL, bool FollowSymlinks = false);
+bool StatFile(str *Path, file *File, bool FollowSymlinks = false); // Fills everything but the name, false if Path does not exist.
+bool FileDevice(str *Path, u64 *Device); // The file system Path is on (st_dev, the volume serial number on Windows).
 
 // ---------------------------------------------------------------------------------------
 
 int RunCommandLineProgram(str *Command);
+str FindExecutable(str *Program); // Full path (zero-terminated) the way the shell would find it, empty if none.
+bool WaitForAnyProcess(process_id *Process, int *ExitCode, u64 TimeoutNanoseconds = WAIT_FOREVER);
+void KillProcess(process_id Process, bool Force); // SIGTERM (SIGKILL if Force) to its process group.
 void Copy(void * Dst, const void * RESTRICT Src, usize Size);
-PRINTFLIKE(1,2) int Printf(const char *Format, ...);
+bool StderrIsTerminal();
+void WriteStderr(char *Data, usize Size); // Unbuffered, one system call.
+void WriteStdout(char *Data, usize Size); // Unbuffered, Printf() is what buffers.
+bool SaveFile(str *Path, void *Data, usize Size); // Creates or replaces Path with Data.
+
+struct mapped_file {
+    u8   *Data;
+    usize Size;
+    s64   Handle; // Windows: mapping object.
+};
+bool MapFile(str *Path, mapped_file *Map); // Read-only, whole file.
+void UnmapFile(mapped_file *Map);
+bool ReplaceWithHardLink(str *Existing, str *Path); // Path becomes another name of Existing.
+bool CloneFile(str *Existing, str *Path); // Path becomes a copy of Existing, sharing its blocks where the file system can (reflink).
+
+namespace file_advice {
+enum file_advice {
+    WillNeed, // Start reading it into the page cache.
+    DontNeed  // Drop its clean pages from the page cache.
+};
+}
+void AdviseFile(str *Path, file_advice::file_advice Advice); // Whole file. A hint: ignored where unsupported.
+
+// For lists that cannot be mapped (pipes): "-" is standard input.
+s64  OpenInput(str *Path); // -1 if it cannot be opened.
+s64  ReadInput(s64 Handle, void *Buffer, usize Size); // Whatever is there (waits for some), 0 at the end, -1 on errors.
+void CloseInput(s64 Handle);
+
+typedef void *thread;
+typedef void (*thread_function)(void *Argument);
+thread StartThread(thread_function Function, void *Argument);
+void JoinThread(thread Thread);
+
+// A count of wakeups between threads: WaitSemaphore() blocks until one is there and takes it.
+typedef void *semaphore;
+semaphore MakeSemaphore();
+void SignalSemaphore(semaphore Semaphore, uint Count = 1);
+void WaitSemaphore(semaphore Semaphore);
+void FreeSemaphore(semaphore Semaphore);
+
+u64 Nanoseconds(); // Monotonic.
+void SleepNanoseconds(u64 Duration);
+uint CpuCount();
+uint NumaNodeCount();
+
+// Pressure stall percentages are 10 second averages of the "some" line
+// (/proc/pressure/*), -1 where the platform does not report them.
+struct system_pressure {
+    float Cpu;
+    float Memory;
+    float Io;
+    float LoadAverage;     // 1 minute, -1 if unavailable.
+    u64   MemoryAvailable; // Bytes, 0 if unavailable.
+};
+void SampleSystemPressure(system_pressure *Pressure);
 
 #endif
\ No newline at end of file
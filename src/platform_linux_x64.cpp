@@ -0,0 +1,297 @@
+#include "common.h"
+#include "platform.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "platform_posix.cpp"
+
+array<file> ReadDirectory(str &Directory, bool WithFileInfo, throttle *Throttle, bool FollowSymlinks) {
+    struct array<file> Result;
+
+    ThrottleWait(Throttle, 1, 0);
+
+    auto Handle = opendir(Directory.Chars);
+    if (!Handle) return Result;
+
+    dirent *Entry;
+    while ((Entry = readdir(Handle))) {
+        // Unlike MacOS, Linux file systems do not promise "." and ".." come first.
+        char *Name = Entry->d_name;
+        if (Name[0] == '.' && (Name[1] == '\0' || (Name[1] == '.' && Name[2] == '\0'))) continue;
+
+        file File;
+        File.Size = 0;
+        File.ModifiedTime = 0;
+        File.Name = str::Copy(Name, strlen(Name));
+        File.Type = file_type::Invalid;
+        File.Device = 0;
+        File.FileSystem = File.Inode = 0;
+        File.Links = 0;
+        File.Offset = File.Chunk = 0;
+
+        auto Type = DTTOIF(Entry->d_type);
+        if (Entry->d_type == DT_UNKNOWN || WithFileInfo || FollowSymlinks) {
+            ThrottleWait(Throttle, 1, 0);
+            struct stat Stat = {};
+            if (fstatat(dirfd(Handle), Name, &Stat, FollowSymlinks ? 0 : AT_SYMLINK_NOFOLLOW) == 0) {
+                Type = Stat.st_mode;
+                if (S_ISREG(Type)) File.Size = Stat.st_size;
+                File.ModifiedTime = (u64)Stat.st_mtim.tv_sec * 1000000000llu + (u64)Stat.st_mtim.tv_nsec;
+                File.FileSystem = (u64)Stat.st_dev;
+                File.Inode      = (u64)Stat.st_ino;
+                File.Links      = (uint)Stat.st_nlink;
+            }
+        }
+
+        if (S_ISDIR(Type)) {
+            File.Type = file_type::Directory;
+        }
+
+        if (S_ISREG(Type)) {
+            File.Type = file_type::File;
+        }
+
+        Result.Push(File);
+    }
+    closedir(Handle);
+
+    return Result;
+}
+
+array<file> ReadDirectory(str *Directory, bool WithFileInfo, throttle *Throttle, bool FollowSymlinks) {
+    return ReadDirectory(*Directory, WithFileInfo, Throttle, FollowSymlinks);
+}
+
+bool StatFile(str *Path, file *File, bool FollowSymlinks) {
+    struct stat Stat = {};
+    if ((FollowSymlinks ? stat(Path->Chars, &Stat) : lstat(Path->Chars, &Stat)) != 0) return false;
+    File->FileSystem = (u64)Stat.st_dev;
+    File->Inode      = (u64)Stat.st_ino;
+    File->Links      = (uint)Stat.st_nlink;
+    File->Size = S_ISREG(Stat.st_mode) ? Stat.st_size : 0;
+    File->ModifiedTime = (u64)Stat.st_mtim.tv_sec * 1000000000llu + (u64)Stat.st_mtim.tv_nsec;
+    File->Type = S_ISDIR(Stat.st_mode) ? file_type::Directory : S_ISREG(Stat.st_mode) ? file_type::File : file_type::Invalid;
+    return true;
+}
+
+#define FICLONE _IOW(0x94, 9, int) // <linux/fs.h>
+
+// Without reflinks (or across file systems) the kernel copies, with read() and write() as
+// the last resort for kernels without copy_file_range().
+static bool CopyContent(int Source, int Destination, u64 Size) {
+    if (ioctl(Destination, FICLONE, Source) == 0) return true;
+
+    u64 Copied = 0;
+    while (Copied < Size) {
+        ssize_t Count = copy_file_range(Source, NULL, Destination, NULL, Size - Copied, 0);
+        if (Count <= 0) break;
+        Copied += (u64)Count;
+    }
+    if (Copied == Size) return true;
+
+    char Buffer[KILOBYTES(64)];
+    for (;;) {
+        ssize_t Count = pread(Source, Buffer, sizeof(Buffer), (off_t)Copied);
+        if (Count == 0) return true;
+        if (Count < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        for (ssize_t Written = 0; Written < Count;) {
+            ssize_t Done = pwrite(Destination, Buffer + Written, (usize)(Count - Written), (off_t)(Copied + Written));
+            if (Done < 0 && errno != EINTR) return false;
+            if (Done > 0) Written += Done;
+        }
+        Copied += (u64)Count;
+    }
+}
+
+static bool CloneContent(char *Existing, char *Path) {
+    int Source = open(Existing, O_RDONLY | O_CLOEXEC);
+    if (Source < 0) return false;
+    struct stat Stat = {};
+    fstat(Source, &Stat);
+    int Destination = open(Path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, Stat.st_mode & 0777);
+    if (Destination < 0) {
+        close(Source);
+        return false;
+    }
+
+    bool Result = CopyContent(Source, Destination, (u64)Stat.st_size);
+    close(Destination);
+    close(Source);
+    if (!Result) unlink(Path);
+    return Result;
+}
+
+static ssize_t FillPipe(int Pipe, int File, u8 *Data, u64 Offset, usize Size) {
+    loff_t From = (loff_t)Offset;
+    ssize_t Count = splice(File, &From, Pipe, NULL, Size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (Count < 0 && errno == EINVAL) Count = write(Pipe, Data + Offset, Size); // A file system without splice().
+    return Count;
+}
+
+void AdviseFile(str *Path, file_advice::file_advice Advice) {
+    // Non-blocking so a FIFO in the listing cannot hang us.
+    int Fd = open(Path->Chars, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (Fd < 0) return;
+    posix_fadvise(Fd, 0, 0, (Advice == file_advice::WillNeed) ? POSIX_FADV_WILLNEED : POSIX_FADV_DONTNEED);
+    close(Fd);
+}
+
+// Reads a small /proc file into Buffer (zero-terminated), returns false if unavailable.
+static bool ReadProcFile(const char *Path, char *Buffer, usize BufferSize) {
+    int Fd = open(Path, O_RDONLY | O_CLOEXEC);
+    if (Fd < 0) return false;
+    ssize_t Count = read(Fd, Buffer, BufferSize - 1);
+    close(Fd);
+    if (Count <= 0) return false;
+    Buffer[Count] = '\0';
+    return true;
+}
+
+// "some avg10=1.23 avg60=0.50 avg300=0.10 total=12345"
+static float ReadPressureStall(const char *Path) {
+    char Buffer[256];
+    if (!ReadProcFile(Path, Buffer, sizeof(Buffer))) return -1;
+    char *Avg10 = strstr(Buffer, "some avg10=");
+    if (!Avg10) return -1;
+    return strtof(Avg10 + sizeof("some avg10=") - 1, NULL);
+}
+
+void SampleSystemPressure(system_pressure *Pressure) {
+    Pressure->Cpu    = ReadPressureStall("/proc/pressure/cpu");
+    Pressure->Memory = ReadPressureStall("/proc/pressure/memory");
+    Pressure->Io     = ReadPressureStall("/proc/pressure/io");
+
+    char Buffer[4096];
+    Pressure->LoadAverage = -1;
+    if (ReadProcFile("/proc/loadavg", Buffer, sizeof(Buffer))) {
+        Pressure->LoadAverage = strtof(Buffer, NULL);
+    }
+
+    Pressure->MemoryAvailable = 0;
+    if (ReadProcFile("/proc/meminfo", Buffer, sizeof(Buffer))) {
+        char *Available = strstr(Buffer, "MemAvailable:");
+        if (Available) {
+            Pressure->MemoryAvailable = strtoull(Available + sizeof("MemAvailable:") - 1, NULL, 10) * 1024; // Reported in kB.
+        }
+    }
+}
+
+// Child placement -----------------------------------------------------------------------
+
+// Not in glibc headers (<linux/ioprio.h>, <numaif.h>).
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE    2
+#define IOPRIO_CLASS_IDLE  3
+#define IOPRIO_WHO_PROCESS 1
+#define MPOL_BIND          2
+
+#define MAX_NUMA_NODES 64
+
+static struct {
+    bool Read;
+    int  CpuCount;              // CPUs in our own affinity mask (taskset, cgroups)...
+    int  Cpus[CPU_SETSIZE];     // ...and their ids.
+    int  NodeCount;
+    int  Nodes[MAX_NUMA_NODES]; // Online node ids.
+    cpu_set_t NodeCpus[MAX_NUMA_NODES];
+} Topology;
+
+// "0-3,8,10-11"
+static void ParseCpuList(char *List, cpu_set_t *Set) {
+    CPU_ZERO(Set);
+    char *C = List;
+    while (*C >= '0' && *C <= '9') {
+        long First = strtol(C, &C, 10);
+        long Last  = First;
+        if (*C == '-') Last = strtol(C + 1, &C, 10);
+        for (long I = First; I <= Last && I < CPU_SETSIZE; ++I) CPU_SET(I, Set);
+        if (*C == ',') C += 1;
+    }
+}
+
+static void ReadTopology() {
+    if (Topology.Read) return;
+    Topology.Read = true;
+
+    cpu_set_t Allowed;
+    if (sched_getaffinity(0, sizeof(Allowed), &Allowed) != 0) {
+        CPU_ZERO(&Allowed);
+        for (uint I = 0; I < CpuCount(); ++I) CPU_SET(I, &Allowed);
+    }
+    for (int I = 0; I < CPU_SETSIZE; ++I) {
+        if (CPU_ISSET(I, &Allowed)) Topology.Cpus[Topology.CpuCount++] = I;
+    }
+
+    char Buffer[4096];
+    cpu_set_t Online;
+    if (!ReadProcFile("/sys/devices/system/node/online", Buffer, sizeof(Buffer))) return;
+    ParseCpuList(Buffer, &Online);
+
+    for (int Node = 0; Node < MAX_NUMA_NODES; ++Node) {
+        if (!CPU_ISSET(Node, &Online)) continue;
+
+        char Path[64];
+        snprintf(Path, sizeof(Path), "/sys/devices/system/node/node%d/cpulist", Node);
+        if (!ReadProcFile(Path, Buffer, sizeof(Buffer))) continue;
+
+        auto Cpus = &Topology.NodeCpus[Topology.NodeCount];
+        ParseCpuList(Buffer, Cpus);
+        CPU_AND(Cpus, Cpus, &Allowed);
+        if (CPU_COUNT(Cpus) == 0) continue; // Memory-only node, or none of its CPUs are ours.
+
+        Topology.Nodes[Topology.NodeCount++] = Node;
+    }
+}
+
+uint NumaNodeCount() {
+    ReadTopology();
+    return Topology.NodeCount ? Topology.NodeCount : 1;
+}
+
+static void PrepareSpawnOptions(spawn_options *Options) {
+    ReadTopology();
+}
+
+static void ApplySpawnOptions(spawn_options *Options) {
+    if (Options->NumaNode >= 0 && Topology.NodeCount > 0) {
+        int Index = Options->NumaNode % Topology.NodeCount;
+        sched_setaffinity(0, sizeof(cpu_set_t), &Topology.NodeCpus[Index]);
+
+        unsigned long NodeMask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {};
+        int Node = Topology.Nodes[Index];
+        NodeMask[Node / (8 * sizeof(unsigned long))] |= 1ul << (Node % (8 * sizeof(unsigned long)));
+        syscall(SYS_set_mempolicy, MPOL_BIND, NodeMask, MAX_NUMA_NODES + 1);
+    } else if (Options->Cpu >= 0 && Topology.CpuCount > 0) {
+        cpu_set_t Set;
+        CPU_ZERO(&Set);
+        CPU_SET(Topology.Cpus[Options->Cpu % Topology.CpuCount], &Set);
+        sched_setaffinity(0, sizeof(Set), &Set);
+    }
+
+    if (Options->Nice) {
+        setpriority(PRIO_PROCESS, 0, getpriority(PRIO_PROCESS, 0) + Options->Nice);
+    }
+
+    switch (Options->IoPriority) {
+        case io_priority::Unchanged: break;
+        case io_priority::BestEffort: {
+            syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7);
+        } break;
+        case io_priority::Idle: {
+            syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, (IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT));
+        } break;
+    }
+}
@@ -5,23 +5,23 @@
 #include "stdlib.h"
 #include <cstring>
 #include <dirent.h>
+#include <copyfile.h>
 #include <sys/dirent.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <mach/mach.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 
-void * Malloc_(usize Size, char *Function) {
-    return malloc(Size);
-}
-
-void Free(void * Memory) {
-    free(Memory);
-}
+#include "platform_posix.cpp"
 
-array<file> ReadDirectory(str &Directory, bool GetFileSizes) {
+array<file> ReadDirectory(str &Directory, bool WithFileInfo, throttle *Throttle, bool FollowSymlinks) {
     struct array<file> Result;
 
+    ThrottleWait(Throttle, 1, 0);
+
     auto Handle = opendir(Directory.Chars);
     if (!Handle) return Result;
 
@@ -32,9 +32,28 @@ array<file> ReadDirectory(str &Directory, bool GetFileSizes) {
     while ((Entry = readdir(Handle))) {
         file File;
         File.Size = 0;
+        File.ModifiedTime = 0;
         File.Name = str::Copy(Entry->d_name, Entry->d_namlen);
+        File.Type = file_type::Invalid;
+        File.Device = 0;
+        File.FileSystem = File.Inode = 0;
+        File.Links = 0;
+        File.Offset = File.Chunk = 0;
 
+        // Not every file system fills in d_type (network ones, some FUSE ones).
         auto Type = DTTOIF(Entry->d_type);
+        if (Entry->d_type == DT_UNKNOWN || WithFileInfo || FollowSymlinks) {
+            ThrottleWait(Throttle, 1, 0);
+            struct stat Stat = {};
+            if (fstatat(dirfd(Handle), Entry->d_name, &Stat, FollowSymlinks ? 0 : AT_SYMLINK_NOFOLLOW) == 0) {
+                Type = Stat.st_mode;
+                if (S_ISREG(Stat.st_mode)) File.Size = Stat.st_size;
+                File.ModifiedTime = (u64)Stat.st_mtimespec.tv_sec * 1000000000llu + (u64)Stat.st_mtimespec.tv_nsec;
+                File.FileSystem = (u64)Stat.st_dev;
+                File.Inode      = (u64)Stat.st_ino;
+                File.Links      = (uint)Stat.st_nlink;
+            }
+        }
 
         if (S_ISDIR(Type)) {
             File.Type = file_type::Directory;
@@ -46,153 +65,93 @@ array<file> ReadDirectory(str &Directory, bool GetFileSizes) {
 
         Result.Push(File);
     }
+    closedir(Handle);
 
     return Result;
 }
 
-array<file> ReadDirectory(str *Directory, bool GetFileSizes) {
-    return ReadDirectory(*Directory, GetFileSizes);
+array<file> ReadDirectory(str *Directory, bool WithFileInfo, throttle *Throttle, bool FollowSymlinks) {
+    return ReadDirectory(*Directory, WithFileInfo, Throttle, FollowSymlinks);
 }
 
-file_type::file_type FileType(str *Path) {
+bool StatFile(str *Path, file *File, bool FollowSymlinks) {
     struct stat Stat = {};
-    lstat(Path->Chars, &Stat);
-    if (S_ISDIR(Stat.st_mode)) return file_type::Directory;
-    else if (S_ISREG(Stat.st_mode)) return file_type::File;
-    else return file_type::Invalid;
+    if ((FollowSymlinks ? stat(Path->Chars, &Stat) : lstat(Path->Chars, &Stat)) != 0) return false;
+    File->FileSystem = (u64)Stat.st_dev;
+    File->Inode      = (u64)Stat.st_ino;
+    File->Links      = (uint)Stat.st_nlink;
+    File->Size = S_ISREG(Stat.st_mode) ? Stat.st_size : 0;
+    File->ModifiedTime = (u64)Stat.st_mtimespec.tv_sec * 1000000000llu + (u64)Stat.st_mtimespec.tv_nsec;
+    File->Type = S_ISDIR(Stat.st_mode) ? file_type::Directory : S_ISREG(Stat.st_mode) ? file_type::File : file_type::Invalid;
+    return true;
 }
 
-void DeleteDirectory(char *Path, char* PathEnd) {
-    auto Path_ = str(Path);
-    auto Children = ReadDirectory(Path_);
-
-    foreach(Children) {
-        switch (It->Type) {
-            case file_type::Directory: {
-                Copy(PathEnd, It->Name.Chars, It->Name.Size);
-                PathEnd[It->Name.Size+0] = '/';
-                PathEnd[It->Name.Size+1] = '\0';
-
-                DeleteDirectory(Path, PathEnd + It->Name.Size + 1);
-                int DelResult = rmdir(Path);
-                if (DelResult) {
-                    auto Error = strerror(errno);
-                    Printf(c_dim_red "[E] " c_grey "Failed to remove directory \"" c_yellow "%s" c_grey "\" (%s)\n", Path, Error);
-                }
-
-                PathEnd[0] = '\0';
-            } break;
-
-            case file_type::File: {
-                Copy(PathEnd, It->Name.Chars, It->Name.Size);
-                PathEnd[It->Name.Size] = '\0';
-
-                int DelResult = unlink(Path);
-                if (DelResult) {
-                    auto Error = strerror(errno);
-                    Printf(c_dim_red "[E] " c_grey "Failed to remove file \"" c_yellow "%s" c_grey "\" (%s)\n", Path, Error);
-                }
-
-                PathEnd[0] = '\0';
-            } break;
-
-            case file_type::Invalid:
-                // @Unhandled:
-            break;
-        }
-    }
-
-    Free(Children.Data);
+static bool CloneContent(char *Existing, char *Path) {
+    // A clone on APFS, a copy elsewhere.
+    if (copyfile(Existing, Path, NULL, COPYFILE_CLONE) == 0) return true;
+    unlink(Path);
+    return false;
 }
 
-void Delete(str *Path) {
-    switch (FileType(Path)) {
-        case file_type::Directory: {
-            usize PathCount = Path->Size;
-            assert0(PathCount > 0);
-
-            auto PathBuffer = MallocCount<char>(99999);
-            Copy(PathBuffer, Path->Chars, PathCount);
-            if (PathBuffer[PathCount-1] != '/') PathBuffer[PathCount++] = '/';
-            PathBuffer[PathCount] = '\0';
-
-            DeleteDirectory(PathBuffer, &PathBuffer[PathCount]);
-            int DelResult = rmdir(PathBuffer);
-            if (DelResult) {
-                auto Error = strerror(errno);
-                Printf(c_dim_red "[E] " c_grey "Failed to remove directory \"" c_yellow "%s" c_grey "\" (%s)\n", PathBuffer, Error);
-            }
-
-            Free(PathBuffer);
-        } break;
-
-        case file_type::File: {
-            unlink(Path->Chars); // @NoErrorHandling:
-        } break;
+// No splice() on MacOS: written from the map.
+static ssize_t FillPipe(int Pipe, int File, u8 *Data, u64 Offset, usize Size) {
+    return write(Pipe, Data + Offset, Size);
+}
 
-        case file_type::Invalid:
-            // @NoInvalidArgumentHandling:
-        break;
+// No posix_fadvise() on MacOS: read-ahead has F_RDADVISE, dropping pages has nothing.
+void AdviseFile(str *Path, file_advice::file_advice Advice) {
+    if (Advice != file_advice::WillNeed) return;
+    int Fd = open(Path->Chars, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (Fd < 0) return;
+    struct stat Stat = {};
+    if (fstat(Fd, &Stat) == 0 && S_ISREG(Stat.st_mode)) {
+        struct radvisory Advisory = {};
+        Advisory.ra_offset = 0;
+        Advisory.ra_count  = (int)MIN((u64)Stat.st_size, (u64)0x7fffffff);
+        fcntl(Fd, F_RDADVISE, &Advisory);
     }
+    close(Fd);
 }
 
-str GetCwd() {
-    str Result;
-    Result.Chars = getcwd(NULL, 0);
-    Result.Size   = strlen(Result.Chars);
+// No pressure stall information on MacOS: load average and free + inactive pages only.
+void SampleSystemPressure(system_pressure *Pressure) {
+    Pressure->Cpu    = -1;
+    Pressure->Memory = -1;
+    Pressure->Io     = -1;
 
-    // Unless cwd is "/", getcwd() will return path without terminating "/", so we append it manually.
-    if (false == Result.EndsWith('/')) {
-        auto ResultNormalized = Result.Cat('/');
-        free(Result.Chars);
-        Result = ResultNormalized;
-    }
+    double Load[1];
+    Pressure->LoadAverage = (getloadavg(Load, 1) == 1) ? (float)Load[0] : -1;
 
-    return Result;
-}
-
-int RunCommandLineProgram(char **Command) {
-    int ExitCode = -1;
-    pid_t Pid;
-    if ((Pid = fork()) < 0) {
-        perror("[E] Fork failed");
-        ExitCode = -1;
-    } else if (Pid > 0) {
-        auto res = waitpid(Pid, &ExitCode, 0);
-        return ExitCode;
-    } else {
-        execvp(Command[0], Command);
-        // We should not be here!
-        exit(-1);
+    Pressure->MemoryAvailable = 0;
+    vm_statistics64_data_t VmStats;
+    mach_msg_type_number_t VmStatsCount = HOST_VM_INFO64_COUNT;
+    if (KERN_SUCCESS == host_statistics64(mach_host_self(), HOST_VM_INFO64, (host_info64_t)&VmStats, &VmStatsCount)) {
+        Pressure->MemoryAvailable = (u64)(VmStats.free_count + VmStats.inactive_count) * (u64)vm_page_size;
     }
-    // We should not be here!
-    return ExitCode;
 }
 
-int RunCommandLineProgram(array<str> Command) {
-    array<char *> Commands;
-    foreach(Command) {
-        It->Chars[It->Size] = '\0';
-        Commands.Push(It->Chars);
-    }
-
-    auto ExitCode = RunCommandLineProgram(Commands.Data);
+// Child placement -----------------------------------------------------------------------
 
-    return ExitCode;
+// MacOS has neither CPU affinity nor NUMA: only nice and the disk I/O policy apply.
+uint NumaNodeCount() {
+    return 1;
 }
 
-void Exit(int ExitCode) {
-    _Exit(ExitCode);
+static void PrepareSpawnOptions(spawn_options *Options) {
 }
 
-PRINTFLIKE(1,2) int Printf(const char *Format, ...) {
-    __builtin_va_list Args;
-    __builtin_va_start(Args, Format);
-    auto Result = vprintf(Format, Args);
-    __builtin_va_end(Args);
-    return Result;
-}
+static void ApplySpawnOptions(spawn_options *Options) {
+    if (Options->Nice) {
+        setpriority(PRIO_PROCESS, 0, getpriority(PRIO_PROCESS, 0) + Options->Nice);
+    }
 
-void Copy(void *Dest, const void * RESTRICT Src, usize Size) {
-    memcpy(Dest, Src, Size);
+    switch (Options->IoPriority) {
+        case io_priority::Unchanged: break;
+        case io_priority::BestEffort: {
+            setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_PROCESS, IOPOL_UTILITY);
+        } break;
+        case io_priority::Idle: {
+            setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_PROCESS, IOPOL_THROTTLE);
+        } break;
+    }
 }
@@ -0,0 +1,979 @@
+// Shared between the MacOS and Linux backends, included by each of them after their
+// system headers.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+void * Malloc_(usize Size, char *Function) {
+#if DEBUG_ALLOCATIONS
+    return allocate_debug(Size, Function, NULL, 0);
+#else
+    return malloc(Size);
+#endif
+}
+
+void Free(void * Memory) {
+#if DEBUG_ALLOCATIONS
+    deallocate_debug(Memory);
+#else
+    free(Memory);
+#endif
+}
+
+file_type::file_type FileType(str *Path) {
+    struct stat Stat = {};
+    lstat(Path->Chars, &Stat);
+    if (S_ISDIR(Stat.st_mode)) return file_type::Directory;
+    else if (S_ISREG(Stat.st_mode)) return file_type::File;
+    else return file_type::Invalid;
+}
+
+bool MakeDirectory(str *Path) {
+    if (mkdir(Path->Chars, 0777) == 0) return true;
+    return errno == EEXIST && FileType(Path) == file_type::Directory;
+}
+
+bool RenamePath(str *Path, str *NewPath) {
+    return rename(Path->Chars, NewPath->Chars) == 0;
+}
+
+bool FileDevice(str *Path, u64 *Device) {
+    struct stat Stat = {};
+    if (stat(Path->Chars, &Stat) != 0) return false;
+    *Device = (u64)Stat.st_dev;
+    return true;
+}
+
+void DeleteDirectory(char *Path, char* PathEnd, throttle *Throttle) {
+    auto Path_ = str(Path);
+    auto Children = ReadDirectory(Path_, false, Throttle);
+
+    foreach(Children) {
+        switch (It->Type) {
+            case file_type::Directory: {
+                Copy(PathEnd, It->Name.Chars, It->Name.Size);
+                PathEnd[It->Name.Size+0] = '/';
+                PathEnd[It->Name.Size+1] = '\0';
+
+                DeleteDirectory(Path, PathEnd + It->Name.Size + 1, Throttle);
+                ThrottleWait(Throttle, 1, 0);
+                int DelResult = rmdir(Path);
+                if (DelResult && errno != ENOENT) { // Gone already is what was wanted.
+                    auto Error = strerror(errno);
+                    Printf(c_dim_red "[E] " c_grey "Failed to remove directory \"" c_yellow "%s" c_grey "\" (%s)\n", Path, Error);
+                }
+
+                PathEnd[0] = '\0';
+            } break;
+
+            case file_type::File: {
+                Copy(PathEnd, It->Name.Chars, It->Name.Size);
+                PathEnd[It->Name.Size] = '\0';
+
+                ThrottleWait(Throttle, 1, 0);
+                int DelResult = unlink(Path);
+                if (DelResult && errno != ENOENT) {
+                    auto Error = strerror(errno);
+                    Printf(c_dim_red "[E] " c_grey "Failed to remove file \"" c_yellow "%s" c_grey "\" (%s)\n", Path, Error);
+                }
+
+                PathEnd[0] = '\0';
+            } break;
+
+            case file_type::Invalid:
+                // @Unhandled:
+            break;
+        }
+    }
+
+    Free(Children.Data);
+}
+
+void Delete(str *Path, throttle *Throttle) {
+    switch (FileType(Path)) {
+        case file_type::Directory: {
+            usize PathCount = Path->Size;
+            assert0(PathCount > 0);
+
+            auto PathBuffer = MallocCount<char>(99999);
+            Copy(PathBuffer, Path->Chars, PathCount);
+            if (PathBuffer[PathCount-1] != '/') PathBuffer[PathCount++] = '/';
+            PathBuffer[PathCount] = '\0';
+
+            DeleteDirectory(PathBuffer, &PathBuffer[PathCount], Throttle);
+            ThrottleWait(Throttle, 1, 0);
+            int DelResult = rmdir(PathBuffer);
+            if (DelResult && errno != ENOENT) {
+                auto Error = strerror(errno);
+                Printf(c_dim_red "[E] " c_grey "Failed to remove directory \"" c_yellow "%s" c_grey "\" (%s)\n", PathBuffer, Error);
+            }
+
+            Free(PathBuffer);
+        } break;
+
+        case file_type::File: {
+            ThrottleWait(Throttle, 1, 0);
+            unlink(Path->Chars); // @NoErrorHandling:
+        } break;
+
+        case file_type::Invalid:
+            // @NoInvalidArgumentHandling:
+        break;
+    }
+}
+
+str GetCwd() {
+    str Result;
+    Result.Chars = getcwd(NULL, 0);
+    Result.Size   = strlen(Result.Chars);
+
+    // Unless cwd is "/", getcwd() will return path without terminating "/", so we append it manually.
+    if (false == Result.EndsWith('/')) {
+        auto ResultNormalized = Result.Cat('/');
+        free(Result.Chars);
+        Result = ResultNormalized;
+    }
+
+    return Result;
+}
+
+// Child processes -----------------------------------------------------------------------
+
+// SIGCHLD is turned into a byte on a pipe so WaitForAnyProcess() can poll() with a timeout
+// (MacOS has no sigtimedwait()).
+static int ChildSignalPipe[2] = {-1, -1};
+
+static void OnChildSignal(int Signal) {
+    int SavedErrno = errno;
+    char Byte = 0;
+    write(ChildSignalPipe[1], &Byte, 1);
+    errno = SavedErrno;
+}
+
+static void InitChildSignal() {
+    if (ChildSignalPipe[0] != -1) return;
+
+    if (pipe(ChildSignalPipe) != 0) {
+        perror("[E] pipe() failed");
+        Exit(-1);
+    }
+    for (int I = 0; I < 2; ++I) {
+        fcntl(ChildSignalPipe[I], F_SETFL, fcntl(ChildSignalPipe[I], F_GETFL) | O_NONBLOCK);
+        fcntl(ChildSignalPipe[I], F_SETFD, FD_CLOEXEC);
+    }
+
+    struct sigaction Action = {};
+    Action.sa_handler = OnChildSignal;
+    Action.sa_flags   = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&Action.sa_mask);
+    sigaction(SIGCHLD, &Action, NULL);
+}
+
+// Children that run in process groups of their own do not see the terminal's Ctrl-C, so
+// we pass SIGINT/SIGTERM/SIGHUP on to them before going down ourselves.
+static array<pid_t> ProcessGroups;
+
+static void OnTerminate(int Signal) {
+    for (usize I = 0; I < ProcessGroups.Count; ++I) kill(-ProcessGroups.Data[I], SIGTERM);
+    signal(Signal, SIG_DFL);
+    raise(Signal);
+}
+
+static void AddProcessGroup(pid_t Pid) {
+    if (ProcessGroups.Capacity == 0) {
+        ProcessGroups = array<pid_t>(256);
+        struct sigaction Action = {};
+        Action.sa_handler = OnTerminate;
+        sigemptyset(&Action.sa_mask);
+        sigaction(SIGINT,  &Action, NULL);
+        sigaction(SIGTERM, &Action, NULL);
+        sigaction(SIGHUP,  &Action, NULL);
+    }
+    ProcessGroups.Push(Pid);
+}
+
+static void RemoveProcessGroup(pid_t Pid) {
+    for (usize I = 0; I < ProcessGroups.Count; ++I) {
+        if (ProcessGroups.Data[I] == Pid) {
+            ProcessGroups.Data[I] = ProcessGroups.Data[--ProcessGroups.Count];
+            return;
+        }
+    }
+}
+
+void KillProcess(process_id Process, bool Force) {
+    int Signal = Force ? SIGKILL : SIGTERM;
+    if (kill(-(pid_t)Process, Signal) != 0) kill((pid_t)Process, Signal); // Not a group leader.
+}
+
+// Implemented by each POSIX backend. Prepare runs in the parent before fork(), Apply in
+// the child after it, so Apply must stick to async-signal-safe calls.
+static void PrepareSpawnOptions(spawn_options *Options);
+static void ApplySpawnOptions(spawn_options *Options);
+
+static pid_t ForkExec(char *Path, char **Argv, char **Envp, spawn_options *Options) {
+    InitChildSignal();
+    if (Options) PrepareSpawnOptions(Options);
+    FlushOutput(); // What we said about the child comes before what it says.
+
+    pid_t Pid = fork();
+    if (Pid < 0) {
+        perror("[E] Fork failed");
+        return -1;
+    } else if (Pid == 0) {
+        if (Options && Options->NewProcessGroup) setpgid(0, 0);
+        if (Options && Options->Stdin > 0) dup2(Options->Stdin, STDIN_FILENO);
+        if (Options) ApplySpawnOptions(Options);
+        if (Path) execve(Path, Argv, Envp ? Envp : environ);
+        else      execvp(Argv[0], Argv);
+        // We should not be here!
+        _exit(127);
+    }
+
+    if (Options && Options->NewProcessGroup) setpgid(Pid, Pid); // Both sides do it, so it is done before either of us goes on.
+    return Pid;
+}
+
+// fork() copies our page tables, which gets slow once the listing and its names take
+// gigabytes. So children can come from a fork server instead: a process forked at the
+// start, while we are still small, that gets spawn requests over a socket, answers with
+// the pid and reports each exit (they are its children, not ours). Children get its
+// environment, working directory and standard handles, which are the ones we started with.
+
+namespace fork_message_type {
+enum fork_message_type {
+    Spawned, // Pid is -1 if fork() failed.
+    Exited
+};
+}
+
+struct fork_message {
+    s32 Type;
+    s32 Pid;
+    s32 Status; // As from waitpid().
+};
+
+// Followed by Path (empty for a PATH search) and the ArgCount arguments, each zero-terminated.
+// Options.Stdin, if any, comes along with it (SCM_RIGHTS).
+struct fork_request {
+    u32 Size; // Of the rest, after this field.
+    u32 PathSize;
+    u32 ArgCount;
+    bool HasOptions;
+    spawn_options Options;
+};
+
+#ifdef MSG_NOSIGNAL
+    #define SEND_FLAGS MSG_NOSIGNAL // A gone peer is an error, not a SIGPIPE.
+#else
+    #define SEND_FLAGS 0 // SO_NOSIGPIPE is set on the socket instead.
+#endif
+
+static int ForkServer = -1; // Our end of the socket, -1 while we fork ourselves.
+static usize ForkServerRunning; // Children it has started that we have not heard exit.
+static array<fork_message> ForkServerExits; // Heard while waiting for a Spawned.
+
+static bool SendAll(int Socket, void *Data, usize Size) {
+    auto Bytes = (char *)Data;
+    while (Size) {
+        ssize_t Sent = send(Socket, Bytes, Size, SEND_FLAGS);
+        if (Sent < 0 && errno == EINTR) continue;
+        if (Sent <= 0) return false;
+        Bytes += Sent;
+        Size  -= (usize)Sent;
+    }
+    return true;
+}
+
+static bool ReceiveAll(int Socket, void *Data, usize Size) {
+    auto Bytes = (char *)Data;
+    while (Size) {
+        ssize_t Received = recv(Socket, Bytes, Size, 0);
+        if (Received < 0 && errno == EINTR) continue;
+        if (Received <= 0) return false;
+        Bytes += Received;
+        Size  -= (usize)Received;
+    }
+    return true;
+}
+
+// Descriptor (-1 for none) goes with the first bytes sent. Received, it is a new one of
+// ours (or -1).
+static bool SendWithDescriptor(int Socket, void *Data, usize Size, int Descriptor) {
+    if (Descriptor < 0) return SendAll(Socket, Data, Size);
+
+    union {
+        struct cmsghdr Header; // For the alignment.
+        char Space[CMSG_SPACE(sizeof(int))];
+    } Control = {};
+    struct iovec Bytes = {Data, Size};
+    struct msghdr Message = {};
+    Message.msg_iov        = &Bytes;
+    Message.msg_iovlen     = 1;
+    Message.msg_control    = Control.Space;
+    Message.msg_controllen = sizeof(Control.Space);
+    auto Header = CMSG_FIRSTHDR(&Message);
+    Header->cmsg_level = SOL_SOCKET;
+    Header->cmsg_type  = SCM_RIGHTS;
+    Header->cmsg_len   = CMSG_LEN(sizeof(int));
+    Copy(CMSG_DATA(Header), &Descriptor, sizeof(int));
+
+    ssize_t Sent;
+    while ((Sent = sendmsg(Socket, &Message, SEND_FLAGS)) < 0 && errno == EINTR) {}
+    if (Sent <= 0) return false;
+    return SendAll(Socket, (char *)Data + Sent, Size - (usize)Sent);
+}
+
+static bool ReceiveWithDescriptor(int Socket, void *Data, usize Size, int *Descriptor) {
+    *Descriptor = -1;
+
+    union {
+        struct cmsghdr Header;
+        char Space[CMSG_SPACE(sizeof(int))];
+    } Control = {};
+    struct iovec Bytes = {Data, Size};
+    struct msghdr Message = {};
+    Message.msg_iov        = &Bytes;
+    Message.msg_iovlen     = 1;
+    Message.msg_control    = Control.Space;
+    Message.msg_controllen = sizeof(Control.Space);
+
+    ssize_t Received;
+    while ((Received = recvmsg(Socket, &Message, 0)) < 0 && errno == EINTR) {}
+    if (Received <= 0) return false;
+    for (auto Header = CMSG_FIRSTHDR(&Message); Header; Header = CMSG_NXTHDR(&Message, Header)) {
+        if (Header->cmsg_level == SOL_SOCKET && Header->cmsg_type == SCM_RIGHTS) {
+            Copy(Descriptor, CMSG_DATA(Header), sizeof(int));
+            fcntl(*Descriptor, F_SETFD, FD_CLOEXEC);
+        }
+    }
+    return ReceiveAll(Socket, (char *)Data + Received, Size - (usize)Received);
+}
+
+static void RunForkServer(int Socket) {
+    InitChildSignal();
+
+    array<char> Request;
+    array<char *> Argv;
+    for (;;) {
+        struct pollfd Polls[2] = {};
+        Polls[0].fd     = Socket;
+        Polls[0].events = POLLIN;
+        Polls[1].fd     = ChildSignalPipe[0];
+        Polls[1].events = POLLIN;
+        if (poll(Polls, 2, -1) < 0 && errno != EINTR) _exit(1);
+
+        char Drain[64];
+        while (read(ChildSignalPipe[0], Drain, sizeof(Drain)) > 0) {}
+
+        int Status = 0;
+        pid_t Pid;
+        while ((Pid = waitpid(-1, &Status, WNOHANG)) > 0) {
+            fork_message Message = {fork_message_type::Exited, Pid, Status};
+            if (!SendAll(Socket, &Message, sizeof(Message))) _exit(0);
+        }
+
+        if (!(Polls[0].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+        fork_request Header;
+        int Stdin;
+        if (!ReceiveWithDescriptor(Socket, &Header, sizeof(Header), &Stdin)) _exit(0); // fef is done.
+        Header.Options.Stdin = MAX(Stdin, 0);
+        usize Size = Header.Size - (sizeof(Header) - sizeof(Header.Size));
+        Request.Reserve(Size);
+        if (!ReceiveAll(Socket, Request.Data, Size)) _exit(0);
+
+        char *Path = Header.PathSize ? Request.Data : NULL;
+        char *C = Request.Data + Header.PathSize + 1;
+        Argv.Count = 0;
+        for (u32 I = 0; I < Header.ArgCount; ++I) {
+            Argv.Push(C);
+            C += strlen(C) + 1;
+        }
+        Argv.Push((char *)NULL);
+
+        // Sent before this loop reaps anything again, so the Exited of a pid always
+        // comes after its Spawned.
+        fork_message Message = {fork_message_type::Spawned, -1, 0};
+        Message.Pid = ForkExec(Path, Argv.Data, NULL, Header.HasOptions ? &Header.Options : NULL);
+        if (Stdin >= 0) close(Stdin);
+        if (!SendAll(Socket, &Message, sizeof(Message))) _exit(0);
+    }
+}
+
+bool StartForkServer() {
+    int Sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, Sockets) != 0) return false;
+    for (int I = 0; I < 2; ++I) fcntl(Sockets[I], F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+    int One = 1;
+    setsockopt(Sockets[0], SOL_SOCKET, SO_NOSIGPIPE, &One, sizeof(One));
+    setsockopt(Sockets[1], SOL_SOCKET, SO_NOSIGPIPE, &One, sizeof(One));
+#endif
+
+    FlushOutput();
+    pid_t Pid = fork();
+    if (Pid < 0) {
+        close(Sockets[0]);
+        close(Sockets[1]);
+        return false;
+    } else if (Pid == 0) {
+        close(Sockets[0]);
+        RunForkServer(Sockets[1]);
+        _exit(0);
+    }
+
+    close(Sockets[1]);
+    ForkServer = Sockets[0];
+    return true;
+}
+
+static void ForkServerGone() {
+    Printf(c_dim_red "[E]" c_grey " The fork server is gone." c_default "\n");
+    Exit(-1);
+}
+
+static fork_message ReceiveFromForkServer() {
+    fork_message Message;
+    if (!ReceiveAll(ForkServer, &Message, sizeof(Message))) ForkServerGone();
+    if (Message.Type == fork_message_type::Exited) ForkServerRunning -= 1;
+    return Message;
+}
+
+static pid_t SpawnThroughForkServer(char *Path, char **Argv, spawn_options *Options) {
+    static array<char> Request;
+    Request.Count = 0;
+
+    fork_request Header = {};
+    Header.PathSize   = Path ? (u32)strlen(Path) : 0;
+    Header.HasOptions = Options != NULL;
+    if (Options) Header.Options = *Options;
+    Request.PushCount(sizeof(Header));
+
+    auto Path0 = Path ? Path : (char *)"";
+    usize Size = Header.PathSize + 1;
+    Copy(Request.PushCount(Size), Path0, Size);
+    for (char **Arg = Argv; *Arg; ++Arg, ++Header.ArgCount) {
+        Size = strlen(*Arg) + 1;
+        Copy(Request.PushCount(Size), *Arg, Size);
+    }
+    Header.Size = (u32)(Request.Count - sizeof(Header.Size));
+    Copy(Request.Data, &Header, sizeof(Header));
+
+    FlushOutput();
+    int Stdin = (Options && Options->Stdin > 0) ? Options->Stdin : -1;
+    if (!SendWithDescriptor(ForkServer, Request.Data, Request.Count, Stdin)) ForkServerGone();
+
+    for (;;) {
+        auto Message = ReceiveFromForkServer();
+        if (Message.Type == fork_message_type::Spawned) {
+            if (Message.Pid < 0) {
+                Printf(c_dim_red "[E]" c_grey " Fork failed (in the fork server)." c_default "\n");
+                return -1;
+            }
+            ForkServerRunning += 1;
+            return Message.Pid;
+        }
+        ForkServerExits.Push(Message);
+    }
+}
+
+// With a Path (as found by FindExecutable()) there is no PATH search per child, without
+// one execvp() searches for Argv[0].
+process_id SpawnProcess(char *Path, char **Argv, char **Envp, spawn_options *Options) {
+    pid_t Pid = (ForkServer != -1) ? SpawnThroughForkServer(Path, Argv, Options) : ForkExec(Path, Argv, Envp, Options);
+    if (Pid < 0) return INVALID_PROCESS;
+
+    if (Options && Options->NewProcessGroup) AddProcessGroup(Pid);
+    return Pid;
+}
+
+process_id SpawnProcess(array<str> *Command, spawn_options *Options) {
+    array<char *> Commands(Command->Count + 1);
+    foreach(*Command) {
+        It->Chars[It->Size] = '\0';
+        Commands.Push(It->Chars);
+    }
+    Commands.Push((char *)NULL);
+
+    auto Result = SpawnProcess(NULL, Commands.Data, NULL, Options);
+    Free(Commands.Data);
+
+    return Result;
+}
+
+char ** Environment() {
+    return environ;
+}
+
+static bool IsExecutable(char *Path) {
+    struct stat Stat = {};
+    return stat(Path, &Stat) == 0 && S_ISREG(Stat.st_mode) && access(Path, X_OK) == 0;
+}
+
+str FindExecutable(str *Program) {
+    str Result;
+    if (Program->Size == 0) return Result;
+
+    // "./tool" and "/usr/bin/tool" are not searched for, just like in a shell.
+    if (Program->Contains('/')) {
+        auto Path = str::Copy(Program->Chars, Program->Size);
+        if (IsExecutable(Path.Chars)) return Path;
+        Free(Path.Chars);
+        return Result;
+    }
+
+    char *Paths = getenv("PATH");
+    if (!Paths) Paths = (char *)"/usr/bin:/bin";
+
+    auto Candidate = MallocCount<char>(str::StrSize(Paths) + Program->Size + 2);
+    for (char *C = Paths;;) {
+        auto Directory = str::Until(str(C), ':');
+
+        usize Size = 0;
+        if (Directory.Size == 0) Candidate[Size++] = '.'; // Empty entry is the working directory.
+        Copy(&Candidate[Size], Directory.Chars, Directory.Size);
+        Size += Directory.Size;
+        Candidate[Size++] = '/';
+        Copy(&Candidate[Size], Program->Chars, Program->Size);
+        Size += Program->Size;
+        Candidate[Size] = '\0';
+
+        if (IsExecutable(Candidate)) {
+            Result = str::Copy(Candidate, Size);
+            break;
+        }
+
+        C += Directory.Size;
+        if (*C++ == '\0') break;
+    }
+    Free(Candidate);
+
+    return Result;
+}
+
+static int ExitCodeFromStatus(int Status) {
+    if (WIFEXITED(Status))   return WEXITSTATUS(Status);
+    if (WIFSIGNALED(Status)) return 128 + WTERMSIG(Status);
+    return -1;
+}
+
+static bool WaitForForkServerChild(process_id *Process, int *ExitCode, u64 Deadline) {
+    for (;;) {
+        if (ForkServerExits.Count) {
+            auto Message = ForkServerExits.Data[--ForkServerExits.Count];
+            RemoveProcessGroup(Message.Pid);
+            *Process  = Message.Pid;
+            *ExitCode = ExitCodeFromStatus(Message.Status);
+            return true;
+        }
+        if (ForkServerRunning == 0) return false;
+
+        int TimeoutMs = -1;
+        if (Deadline != WAIT_FOREVER) {
+            u64 Now = Nanoseconds();
+            if (Now >= Deadline) return false;
+            TimeoutMs = (int)((Deadline - Now + 999999) / 1000000);
+        }
+
+        struct pollfd Poll = {};
+        Poll.fd     = ForkServer;
+        Poll.events = POLLIN;
+        if (poll(&Poll, 1, TimeoutMs) > 0) ForkServerExits.Push(ReceiveFromForkServer());
+    }
+}
+
+bool WaitForAnyProcess(process_id *Process, int *ExitCode, u64 TimeoutNanoseconds) {
+    u64 Deadline = (TimeoutNanoseconds == WAIT_FOREVER) ? WAIT_FOREVER : Nanoseconds() + TimeoutNanoseconds;
+    if (ForkServer != -1) return WaitForForkServerChild(Process, ExitCode, Deadline);
+
+    for (;;) {
+        char Drain[64];
+        while (read(ChildSignalPipe[0], Drain, sizeof(Drain)) > 0) {}
+
+        int Status = 0;
+        pid_t Pid = waitpid(-1, &Status, WNOHANG);
+        if (Pid > 0) {
+            RemoveProcessGroup(Pid);
+            *Process  = Pid;
+            *ExitCode = ExitCodeFromStatus(Status);
+            return true;
+        }
+        if (Pid < 0 && errno == ECHILD) return false;
+
+        int TimeoutMs = -1;
+        if (Deadline != WAIT_FOREVER) {
+            u64 Now = Nanoseconds();
+            if (Now >= Deadline) return false;
+            TimeoutMs = (int)((Deadline - Now + 999999) / 1000000);
+        }
+
+        struct pollfd Poll = {};
+        Poll.fd     = ChildSignalPipe[0];
+        Poll.events = POLLIN;
+        poll(&Poll, 1, TimeoutMs);
+    }
+}
+
+int RunCommandLineProgram(array<str> Command) {
+    // Waited for with waitpid(), so it has to be our own child and not the fork server's.
+    int Server = ForkServer;
+    ForkServer = -1;
+    auto Pid = SpawnProcess(&Command);
+    ForkServer = Server;
+    if (Pid == INVALID_PROCESS) return -1;
+
+    int Status = 0;
+    while (waitpid((pid_t)Pid, &Status, 0) < 0 && errno == EINTR) {}
+
+    return ExitCodeFromStatus(Status);
+}
+
+// Streams to children -------------------------------------------------------------------
+
+// A child's standard input can be a range of a file, fed into a pipe by us: as much as the
+// pipe takes right away when it is made, the rest from a thread that poll()s every pipe
+// still being fed. Nothing is copied in between: Linux splice()s from the page cache.
+
+#define STREAM_CHUNK MEGABYTES(1) // At most this much per write, so one pipe does not hold up the others.
+
+// From the backend: moves up to Size bytes of File (mapped whole at Data) from Offset into
+// Pipe, like write().
+static ssize_t FillPipe(int Pipe, int File, u8 *Data, u64 Offset, usize Size);
+
+struct pipe_stream {
+    int  Pipe; // Write end, non-blocking.
+    int  File;
+    u8  *Data;
+    u64  Offset;
+    u64  Left;
+};
+
+static array<pipe_stream> NewStreams; // For the stream thread to pick up.
+static int StreamLock;
+static int StreamWake[2] = {-1, -1};
+
+// False once the stream is done with: all of it written, or nobody reading any more.
+static bool FeedPipe(pipe_stream *Stream) {
+    while (Stream->Left) {
+        ssize_t Count = FillPipe(Stream->Pipe, Stream->File, Stream->Data, Stream->Offset, (usize)MIN(Stream->Left, (u64)STREAM_CHUNK));
+        if (Count < 0 && errno == EINTR) continue;
+        if (Count < 0 && errno == EAGAIN) return true;
+        if (Count <= 0) break; // EPIPE: the child did not want all of it.
+        Stream->Offset += (u64)Count;
+        Stream->Left   -= (u64)Count;
+    }
+    close(Stream->Pipe);
+    return false;
+}
+
+static void StreamWorker(void *Unused) {
+    // A child that stops reading is an EPIPE here, not a SIGPIPE for all of us.
+    sigset_t Blocked;
+    sigemptyset(&Blocked);
+    sigaddset(&Blocked, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &Blocked, NULL);
+
+    array<pipe_stream> Streams;
+    array<struct pollfd> Polls;
+    for (;;) {
+        SpinLock(&StreamLock);
+        foreach(NewStreams) Streams.Push(*It);
+        NewStreams.Reset();
+        SpinUnlock(&StreamLock);
+
+        Polls.Reset();
+        auto Poll = Polls.Push();
+        *Poll = {};
+        Poll->fd     = StreamWake[0];
+        Poll->events = POLLIN;
+        foreach(Streams) {
+            Poll = Polls.Push();
+            *Poll = {};
+            Poll->fd     = It->Pipe;
+            Poll->events = POLLOUT;
+        }
+        if (poll(Polls.Data, (nfds_t)Polls.Count, -1) < 0) continue;
+
+        char Drain[64];
+        while (read(StreamWake[0], Drain, sizeof(Drain)) > 0) {}
+
+        // Backwards, so what takes the place of a finished one has been seen to already.
+        for (usize I = Streams.Count; I-- > 0;) {
+            if (!Polls.Data[I + 1].revents) continue;
+            if (!FeedPipe(&Streams.Data[I])) Streams.Data[I] = Streams.Data[--Streams.Count];
+        }
+    }
+}
+
+// Size bytes of File from Offset, as the read end of a pipe to pass on as spawn_options'
+// Stdin (and close once the child has it), -1 on errors. Data is File mapped whole: what a
+// backend that cannot splice() writes from.
+int StreamToPipe(s64 File, u8 *Data, u64 Offset, u64 Size) {
+    int Pipe[2];
+    if (pipe(Pipe) != 0) return -1;
+    for (int I = 0; I < 2; ++I) fcntl(Pipe[I], F_SETFD, FD_CLOEXEC);
+    fcntl(Pipe[1], F_SETFL, fcntl(Pipe[1], F_GETFL) | O_NONBLOCK);
+
+    pipe_stream Stream = {Pipe[1], (int)File, Data, Offset, Size};
+    if (!FeedPipe(&Stream)) return Pipe[0]; // It all fit.
+
+    if (StreamWake[0] == -1) {
+        if (pipe(StreamWake) != 0) {
+            perror("[E] pipe() failed");
+            Exit(-1);
+        }
+        for (int I = 0; I < 2; ++I) {
+            fcntl(StreamWake[I], F_SETFL, fcntl(StreamWake[I], F_GETFL) | O_NONBLOCK);
+            fcntl(StreamWake[I], F_SETFD, FD_CLOEXEC);
+        }
+        StartThread(StreamWorker, NULL); // Lives as long as we do.
+    }
+
+    SpinLock(&StreamLock);
+    NewStreams.Push(Stream);
+    SpinUnlock(&StreamLock);
+    char Byte = 0;
+    write(StreamWake[1], &Byte, 1);
+
+    return Pipe[0];
+}
+
+// ---------------------------------------------------------------------------------------
+
+bool MapFile(str *Path, mapped_file *Map) {
+    Map->Data = NULL;
+    Map->Size = 0;
+
+    int Fd = open(Path->Chars, O_RDONLY | O_CLOEXEC);
+    if (Fd < 0) return false;
+
+    struct stat Stat = {};
+    if (fstat(Fd, &Stat) != 0 || !S_ISREG(Stat.st_mode)) {
+        close(Fd);
+        return false;
+    }
+
+    Map->Size = (usize)Stat.st_size;
+    if (Map->Size > 0) {
+        void *Data = mmap(NULL, Map->Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+        if (Data == MAP_FAILED) {
+            close(Fd);
+            Map->Size = 0;
+            return false;
+        }
+        madvise(Data, Map->Size, MADV_SEQUENTIAL);
+        Map->Data = (u8 *)Data;
+    }
+    close(Fd); // The mapping keeps the file alive.
+
+    return true;
+}
+
+void UnmapFile(mapped_file *Map) {
+    if (Map->Data) munmap(Map->Data, Map->Size);
+    Map->Data = NULL;
+    Map->Size = 0;
+}
+
+s64 OpenInput(str *Path) {
+    if (Path->Equal(str("-"))) return STDIN_FILENO;
+    return open(Path->Chars, O_RDONLY | O_CLOEXEC);
+}
+
+s64 ReadInput(s64 Handle, void *Buffer, usize Size) {
+    for (;;) {
+        ssize_t Read = read((int)Handle, Buffer, Size);
+        if (Read < 0 && errno == EINTR) continue; // SIGCHLD.
+        return Read;
+    }
+}
+
+void CloseInput(s64 Handle) {
+    if (Handle != STDIN_FILENO) close((int)Handle);
+}
+
+bool ReplaceWithHardLink(str *Existing, str *Path) {
+    // Link under a temporary name first and rename over Path, so Path never goes missing.
+    auto Temporary = MallocCount<char>(Path->Size + 32);
+    snprintf(Temporary, Path->Size + 32, "%.*s.fef-link-%d", (int)Path->Size, Path->Chars, (int)getpid());
+
+    bool Result = link(Existing->Chars, Temporary) == 0;
+    if (Result && rename(Temporary, Path->Chars) != 0) {
+        unlink(Temporary);
+        Result = false;
+    }
+
+    Free(Temporary);
+    return Result;
+}
+
+// From the backend: makes Path (which does not exist) a copy of Existing, a reflink if it can.
+static bool CloneContent(char *Existing, char *Path);
+
+bool CloneFile(str *Existing, str *Path) {
+    // As in ReplaceWithHardLink(), numbered since threads share the pid.
+    static u64 Clones;
+    u64 Clone = __atomic_add_fetch(&Clones, 1, __ATOMIC_RELAXED);
+    auto Temporary = MallocCount<char>(Path->Size + 48);
+    snprintf(Temporary, Path->Size + 48, "%.*s.fef-clone-%d-%llu", (int)Path->Size, Path->Chars, (int)getpid(), (unsigned long long)Clone);
+
+    bool Result = CloneContent(Existing->Chars, Temporary);
+    if (Result && rename(Temporary, Path->Chars) != 0) {
+        unlink(Temporary);
+        Result = false;
+    }
+
+    Free(Temporary);
+    return Result;
+}
+
+struct thread_start {
+    thread_function Function;
+    void *Argument;
+};
+
+static void * ThreadStart(void *Start_) {
+    auto Start = *(thread_start *)Start_;
+    Free(Start_);
+    Start.Function(Start.Argument);
+    return NULL;
+}
+
+thread StartThread(thread_function Function, void *Argument) {
+    auto Start = MallocCount<thread_start>(1);
+    Start->Function = Function;
+    Start->Argument = Argument;
+
+    pthread_t Thread;
+    if (pthread_create(&Thread, NULL, ThreadStart, Start) != 0) {
+        perror("[E] pthread_create() failed");
+        Exit(-1);
+    }
+    return (thread)Thread;
+}
+
+void JoinThread(thread Thread) {
+    pthread_join((pthread_t)Thread, NULL);
+}
+
+// MacOS has no unnamed POSIX semaphores (sem_init() fails), so it is a count under a mutex.
+struct semaphore_state {
+    pthread_mutex_t Mutex;
+    pthread_cond_t  Signaled;
+    u64 Count;
+};
+
+semaphore MakeSemaphore() {
+    auto Semaphore = MallocCount<semaphore_state>(1);
+    pthread_mutex_init(&Semaphore->Mutex, NULL);
+    pthread_cond_init(&Semaphore->Signaled, NULL);
+    Semaphore->Count = 0;
+    return Semaphore;
+}
+
+void SignalSemaphore(semaphore Semaphore_, uint Count) {
+    auto Semaphore = (semaphore_state *)Semaphore_;
+    pthread_mutex_lock(&Semaphore->Mutex);
+    Semaphore->Count += Count;
+    pthread_mutex_unlock(&Semaphore->Mutex);
+    if (Count == 1) pthread_cond_signal(&Semaphore->Signaled);
+    else            pthread_cond_broadcast(&Semaphore->Signaled);
+}
+
+void WaitSemaphore(semaphore Semaphore_) {
+    auto Semaphore = (semaphore_state *)Semaphore_;
+    pthread_mutex_lock(&Semaphore->Mutex);
+    while (Semaphore->Count == 0) pthread_cond_wait(&Semaphore->Signaled, &Semaphore->Mutex);
+    Semaphore->Count -= 1;
+    pthread_mutex_unlock(&Semaphore->Mutex);
+}
+
+void FreeSemaphore(semaphore Semaphore_) {
+    auto Semaphore = (semaphore_state *)Semaphore_;
+    pthread_cond_destroy(&Semaphore->Signaled);
+    pthread_mutex_destroy(&Semaphore->Mutex);
+    Free(Semaphore);
+}
+
+// ---------------------------------------------------------------------------------------
+
+u64 Nanoseconds() {
+    struct timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return (u64)Time.tv_sec * 1000000000llu + (u64)Time.tv_nsec;
+}
+
+void SleepNanoseconds(u64 Duration) {
+    struct timespec Time;
+    Time.tv_sec  = (time_t)(Duration / 1000000000llu);
+    Time.tv_nsec = (long)(Duration % 1000000000llu);
+    while (nanosleep(&Time, &Time) < 0 && errno == EINTR) {}
+}
+
+uint CpuCount() {
+    long Count = sysconf(_SC_NPROCESSORS_ONLN);
+    return Count > 0 ? (uint)Count : 1;
+}
+
+void Exit(int ExitCode) {
+#if DEBUG_ALLOCATIONS
+    if (AllocationReportAtExit) allocation_report();
+#endif
+    FlushOutput();
+    _Exit(ExitCode);
+}
+
+bool StderrIsTerminal() {
+    return isatty(STDERR_FILENO);
+}
+
+static void WriteAll(int Fd, char *Data, usize Size) {
+    while (Size > 0) {
+        ssize_t Written = write(Fd, Data, Size);
+        if (Written < 0 && errno == EINTR) continue;
+        if (Written <= 0) return;
+        Data += Written;
+        Size -= (usize)Written;
+    }
+}
+
+bool SaveFile(str *Path, void *Data, usize Size) {
+    int Fd = open(Path->Chars, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (Fd < 0) return false;
+    auto Bytes = (char *)Data;
+    while (Size > 0) {
+        ssize_t Written = write(Fd, Bytes, Size);
+        if (Written < 0 && errno == EINTR) continue;
+        if (Written <= 0) break;
+        Bytes += Written;
+        Size -= (usize)Written;
+    }
+    return close(Fd) == 0 && Size == 0;
+}
+
+void WriteStderr(char *Data, usize Size) {
+    WriteAll(STDERR_FILENO, Data, Size);
+}
+
+void WriteStdout(char *Data, usize Size) {
+    WriteAll(STDOUT_FILENO, Data, Size);
+}
+
+void Copy(void *Dest, const void * RESTRICT Src, usize Size) {
+    memcpy(Dest, Src, Size);
+}
@@ -6,12 +6,19 @@
 #include <stdlib.h>
 #include "Windows.h"
 
-PRINTFLIKE(1,2) int Printf(const char *Format, ...) {
-    __builtin_va_list Args;
-    __builtin_va_start(Args, Format);
-    auto Result = vprintf(Format, Args);
-    __builtin_va_end(Args);
-    return Result;
+bool StderrIsTerminal() {
+    DWORD Mode;
+    return GetConsoleMode(GetStdHandle(STD_ERROR_HANDLE), &Mode);
+}
+
+void WriteStderr(char *Data, usize Size) {
+    DWORD Written = 0;
+    WriteFile(GetStdHandle(STD_ERROR_HANDLE), Data, (DWORD)Size, &Written, NULL);
+}
+
+void WriteStdout(char *Data, usize Size) {
+    DWORD Written = 0;
+    WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), Data, (DWORD)Size, &Written, NULL);
 }
 
 void Copy(void *Dest, const void * RESTRICT Src, usize Size) {
@@ -137,6 +144,10 @@ str GetCwd() {
 }
 
 void Exit(int ExitCode) {
+#if DEBUG_ALLOCATIONS
+    if (AllocationReportAtExit) allocation_report();
+#endif
+    FlushOutput();
     ExitProcess(ExitCode);
 }
 
@@ -151,7 +162,9 @@ struct ALIGN(1) memory_header {
 };
 
 void * Malloc_(usize Size, char *CallerName) {
-#if GUARD_PAGE && GUARD_PAGE_BEFORE
+#if DEBUG_ALLOCATIONS
+    return allocate_debug(Size, CallerName, NULL, 0);
+#elif GUARD_PAGE && GUARD_PAGE_BEFORE
     // @UNIMLEMENTED.
 #elif GUARD_PAGE
     auto MemReserveSize = __builtin_align_up(Size + sizeof(memory_header), 4096) + 4096;
@@ -192,7 +205,9 @@ void * Malloc_(usize Size, char *CallerName) {
 }
 
 void Free(void * Memory) {
-#if GUARD_PAGE && GUARD_PAGE_BEFORE
+#if DEBUG_ALLOCATIONS
+    deallocate_debug(Memory);
+#elif GUARD_PAGE && GUARD_PAGE_BEFORE
     auto Allocation = (memory_header*)((char*)Memory - sizeof(memory_header));
     usize Size = Allocation->MemReserveSize;
     usize TotalSize = Size + 4096;
@@ -290,9 +305,12 @@ s64 DWORDToInt(DWORD Hi, DWORD Lo) {
     return Number.QuadPart;
 }
 
-array<file> ReadDirectory(str *Directory, bool GetFileSizes) {
+// Symbolic links to directories list as directories, whatever FollowSymlinks says.
+array<file> ReadDirectory(str *Directory, bool WithFileInfo, throttle *Throttle, bool FollowSymlinks) {
     array<file> Files;
 
+    ThrottleWait(Throttle, 1, 0);
+
     auto FindPattern  = Directory->Cat('*');
     auto FindPatternW = UTF8ToWide(&FindPattern);
 
@@ -302,6 +320,11 @@ array<file> ReadDirectory(str *Directory, bool GetFileSizes) {
         file New;
         New.Name = WideToUTF8(FileInfo.cFileName);
         New.Size = DWORDToInt(FileInfo.nFileSizeHigh, FileInfo.nFileSizeLow);
+        New.ModifiedTime = (u64)DWORDToInt(FileInfo.ftLastWriteTime.dwHighDateTime, FileInfo.ftLastWriteTime.dwLowDateTime) * 100; // 100ns ticks.
+        New.Device = 0;
+        New.FileSystem = New.Inode = 0; // It would take opening every file.
+        New.Links = 0;
+        New.Offset = New.Chunk = 0;
         if (FileInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
             New.Type = file_type::Directory;
         else
@@ -316,6 +339,55 @@ array<file> ReadDirectory(str *Directory, bool GetFileSizes) {
     return Files;
 }
 
+bool StatFile(str *Path, file *File, bool FollowSymlinks) {
+    auto PathW = UTF8ToWide(Path);
+    WIN32_FILE_ATTRIBUTE_DATA Data;
+    BOOL Ok = GetFileAttributesExW(PathW.Wchars, GetFileExInfoStandard, &Data);
+    Free(PathW.Wchars);
+    if (!Ok) return false;
+
+    bool IsDirectory = Data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+    File->Size = IsDirectory ? 0 : DWORDToInt(Data.nFileSizeHigh, Data.nFileSizeLow);
+    File->ModifiedTime = (u64)DWORDToInt(Data.ftLastWriteTime.dwHighDateTime, Data.ftLastWriteTime.dwLowDateTime) * 100;
+    File->Type = IsDirectory ? file_type::Directory : file_type::File;
+    File->FileSystem = File->Inode = 0;
+    File->Links = 0;
+    return true;
+}
+
+bool SaveFile(str *Path, void *Data, usize Size) {
+    auto PathW = UTF8ToWide(Path);
+    HANDLE Handle = CreateFileW(PathW.Wchars, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    Free(PathW.Wchars);
+    if (Handle == INVALID_HANDLE_VALUE) return false;
+
+    auto Bytes = (char *)Data;
+    while (Size > 0) {
+        DWORD Written = 0;
+        if (!WriteFile(Handle, Bytes, (DWORD)MIN(Size, (usize)GIGABYTES(1)), &Written, NULL) || Written == 0) break;
+        Bytes += Written;
+        Size -= Written;
+    }
+    CloseHandle(Handle);
+    return Size == 0;
+}
+
+bool FileDevice(str *Path, u64 *Device) {
+    auto PathW = UTF8ToWide(Path);
+    // Backup semantics so directories open too.
+    HANDLE Handle = CreateFileW(PathW.Wchars, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                                OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    Free(PathW.Wchars);
+    if (Handle == INVALID_HANDLE_VALUE) return false;
+
+    BY_HANDLE_FILE_INFORMATION Info;
+    BOOL Ok = GetFileInformationByHandle(Handle, &Info);
+    CloseHandle(Handle);
+    if (!Ok) return false;
+    *Device = Info.dwVolumeSerialNumber;
+    return true;
+}
+
 strw StringAppend(strw *String, wchar_t Character) {
     strw Result;
 
@@ -336,24 +408,99 @@ strw NewString(wchar_t *String) {
     return Result;
 }
 
-int RunCommandLineProgram(str *Command) {
+// Handles of children started by SpawnProcess() that were not yet waited for, and the job
+// object each one was put in (NULL if none), at the same index.
+static array<HANDLE> RunningProcesses;
+static array<HANDLE> RunningJobs;
+
+// Index-th set bit of Mask, Mask itself if there are fewer bits set.
+static DWORD_PTR NthProcessor(DWORD_PTR Mask, int Index) {
+    int Count = __builtin_popcountll(Mask);
+    if (Count == 0) return Mask;
+    Index %= Count;
+    for (int Bit = 0; Bit < 64; ++Bit) {
+        if (!(Mask & ((DWORD_PTR)1 << Bit))) continue;
+        if (Index-- == 0) return (DWORD_PTR)1 << Bit;
+    }
+    return Mask;
+}
+
+uint NumaNodeCount() {
+    ULONG Highest = 0;
+    if (!GetNumaHighestNodeNumber(&Highest)) return 1;
+    return Highest + 1;
+}
+
+// No I/O priority for other processes on Windows (PROCESS_MODE_BACKGROUND_BEGIN only
+// applies to the calling process), so "IoPriority" is ignored.
+static void ApplySpawnOptions(HANDLE Process, spawn_options *Options) {
+    DWORD_PTR ProcessMask = 0, SystemMask = 0;
+    GetProcessAffinityMask(GetCurrentProcess(), &ProcessMask, &SystemMask);
+
+    if (Options->NumaNode >= 0) {
+        ULONGLONG NodeMask = 0;
+        if (GetNumaNodeProcessorMask((UCHAR)(Options->NumaNode % NumaNodeCount()), &NodeMask) && (NodeMask & ProcessMask)) {
+            SetProcessAffinityMask(Process, (DWORD_PTR)NodeMask & ProcessMask);
+        }
+    } else if (Options->Cpu >= 0) {
+        SetProcessAffinityMask(Process, NthProcessor(ProcessMask, Options->Cpu));
+    }
+}
+
+static DWORD PriorityClass(int Nice) {
+    if (Nice >= 15) return IDLE_PRIORITY_CLASS;
+    if (Nice >= 5)  return BELOW_NORMAL_PRIORITY_CLASS;
+    return 0;
+}
+
+str FindExecutable(str *Program) {
+    str Result;
+    if (Program->Size == 0) return Result;
+
+    auto ProgramW = UTF8ToWide(Program);
+    DWORD Size = SearchPathW(NULL, ProgramW.Wchars, L".exe", 0, NULL, NULL);
+    if (Size) {
+        auto PathW = MallocCount<wchar_t>(Size);
+        if (SearchPathW(NULL, ProgramW.Wchars, L".exe", Size, PathW, NULL)) {
+            Result = WideToUTF8(PathW);
+        }
+        Free(PathW);
+    }
+    Free(ProgramW.Wchars);
+
+    return Result;
+}
+
+// The UTF-16 command line CreateProcessW() gets (it wants to be able to write to it),
+// reused between children.
+static array<wchar_t> CommandLineW;
+static array<wchar_t> ApplicationW;
+
+static wchar_t * ToWide(array<wchar_t> *Buffer, str *Str) {
+    Buffer->Reset();
+    Buffer->Reserve(Str->Size + 1); // UTF-16 never needs more units than UTF-8 has bytes.
+    auto End = UTF8ToWide(Buffer->Data, Buffer->Capacity * sizeof(wchar_t), Str);
+    *End = L'\0';
+    return Buffer->Data;
+}
+
+process_id SpawnProcess(str *Command, spawn_options *Options, str *Application) {
     STARTUPINFOW        StartupInfo = {};
     PROCESS_INFORMATION ProcessInfo = {};
     StartupInfo.cb = sizeof(StartupInfo);
 
-    auto CommandW = UTF8ToWide(Command);
-
-    LPCWSTR               lpApplicationName    = NULL;
-    LPWSTR                lpCommandLine        = CommandW.Wchars;
+    LPCWSTR               lpApplicationName    = Application ? ToWide(&ApplicationW, Application) : NULL;
+    LPWSTR                lpCommandLine        = ToWide(&CommandLineW, Command);
     LPSECURITY_ATTRIBUTES lpProcessAttributes  = NULL;
     LPSECURITY_ATTRIBUTES lpThreadAttributes   = NULL;
     BOOL                  bInheritHandles      = FALSE;
-    DWORD                 dwCreationFlags      = 0;
+    DWORD                 dwCreationFlags      = Options ? (CREATE_SUSPENDED | PriorityClass(Options->Nice)) : 0;
     LPVOID                lpEnvironment        = NULL;
     LPCWSTR               lpCurrentDirectory   = NULL;
     LPSTARTUPINFOW        lpStartupInfo        = &StartupInfo;
     LPPROCESS_INFORMATION lpProcessInformation = &ProcessInfo;
 
+    FlushOutput(); // What we said about the child comes before what it says.
     BOOL ProcessCreated = CreateProcessW(
         lpApplicationName,
         lpCommandLine,
@@ -367,36 +514,283 @@ int RunCommandLineProgram(str *Command) {
         lpProcessInformation
     );
 
-    DWORD ExitCode = -1;
-
     if (!ProcessCreated) {
         auto Error = LastError();
         Printf(c_dim_red "[E]" c_grey " Failed to create a process: " c_dim_red FSTR c_default "\n", (int)Error.Size, Error.Chars);
+        return INVALID_PROCESS;
+    }
+
+    // There are no process groups, a job object is what lets KillProcess() take down
+    // whatever the child started as well. It has to be assigned before the child runs.
+    HANDLE Job = NULL;
+    if (Options) {
+        ApplySpawnOptions(ProcessInfo.hProcess, Options);
+        if (Options->NewProcessGroup) {
+            Job = CreateJobObjectW(NULL, NULL);
+            if (Job && !AssignProcessToJobObject(Job, ProcessInfo.hProcess)) {
+                CloseHandle(Job);
+                Job = NULL;
+            }
+        }
+        ResumeThread(ProcessInfo.hThread);
+    }
+
+    CloseHandle(ProcessInfo.hThread);
+    RunningProcesses.Push(ProcessInfo.hProcess);
+    RunningJobs.Push(Job);
+
+    return (process_id)ProcessInfo.hProcess;
+}
+
+static int CollectExitCode(HANDLE Process) {
+    DWORD ExitCode = -1;
+    if (!GetExitCodeProcess(Process, &ExitCode)) {
+        Printf("[W] Unexpectedly failed to get an exit code for a child process\n");
+        ExitCode = -1;
+    }
+
+    for (usize I = 0; I < RunningProcesses.Count; ++I) {
+        if (RunningProcesses.Data[I] == Process) {
+            if (RunningJobs.Data[I]) CloseHandle(RunningJobs.Data[I]);
+            RunningProcesses.Data[I] = RunningProcesses.Data[--RunningProcesses.Count];
+            RunningJobs.Data[I]      = RunningJobs.Data[--RunningJobs.Count];
+            break;
+        }
+    }
+    CloseHandle(Process);
+
+    return (int)ExitCode;
+}
+
+// Nothing like SIGTERM to ask nicely with, so both kinds terminate right away.
+void KillProcess(process_id Process, bool Force) {
+    (void)Force;
+    for (usize I = 0; I < RunningProcesses.Count; ++I) {
+        if (RunningProcesses.Data[I] != (HANDLE)Process) continue;
+        if (RunningJobs.Data[I]) TerminateJobObject(RunningJobs.Data[I], 1);
+        else                     TerminateProcess((HANDLE)Process, 1);
+        return;
+    }
+}
+
+// WaitForMultipleObjects() is limited to MAXIMUM_WAIT_OBJECTS (64) handles, so is the
+// number of children we can keep running at once.
+bool WaitForAnyProcess(process_id *Process, int *ExitCode, u64 TimeoutNanoseconds) {
+    if (RunningProcesses.Count == 0) return false;
+    assert0(RunningProcesses.Count <= MAXIMUM_WAIT_OBJECTS);
+
+    DWORD TimeoutMs = (TimeoutNanoseconds == WAIT_FOREVER) ? INFINITE : (DWORD)((TimeoutNanoseconds + 999999) / 1000000);
+    DWORD WaitResult = WaitForMultipleObjects((DWORD)RunningProcesses.Count, RunningProcesses.Data, FALSE, TimeoutMs);
+    if (WaitResult >= WAIT_OBJECT_0 + RunningProcesses.Count) return false;
+
+    HANDLE Finished = RunningProcesses.Data[WaitResult - WAIT_OBJECT_0];
+    *Process  = (process_id)Finished;
+    *ExitCode = CollectExitCode(Finished);
+    return true;
+}
+
+int RunCommandLineProgram(str *Command) {
+    auto Process = SpawnProcess(Command);
+    if (Process == INVALID_PROCESS) return -1;
+
+    DWORD WaitResult = WaitForSingleObject((HANDLE)Process, INFINITE);
+    if (WaitResult != WAIT_OBJECT_0) {
+        Printf("[W] Unexpectedly failed to wait for the command line tool " FSTR "\n", (int)Command->Size, Command->Chars);
         return -1;
     }
 
-    DWORD WaitResult = WaitForSingleObject(ProcessInfo.hProcess, INFINITE);
-    switch (WaitResult) {
-        case WAIT_ABANDONED: break;
-        case WAIT_OBJECT_0:  ExitCode = 0; break;
-        case WAIT_TIMEOUT:   break;
-        case WAIT_FAILED:    break;
-        default:             break;
+    return CollectExitCode((HANDLE)Process);
+}
+
+bool MapFile(str *Path, mapped_file *Map) {
+    Map->Data   = NULL;
+    Map->Size   = 0;
+    Map->Handle = 0;
+
+    auto PathW = UTF8ToWide(Path);
+    HANDLE File = CreateFileW(PathW.Wchars, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    Free(PathW.Wchars);
+    if (File == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER Size;
+    if (!GetFileSizeEx(File, &Size)) {
+        CloseHandle(File);
+        return false;
     }
 
-    if (ExitCode == 0) {
-        BOOL Ok = GetExitCodeProcess(ProcessInfo.hProcess, &ExitCode);
-        if (!Ok) {
-            Printf("[W] Unexpectedly failed to get an exit code for the command line tool " FSTR "\n", (int)Command->Size, Command->Chars);
-            return -1;
+    Map->Size = (usize)Size.QuadPart;
+    if (Map->Size > 0) {
+        HANDLE Mapping = CreateFileMappingW(File, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (Mapping) Map->Data = (u8 *)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!Map->Data) {
+            if (Mapping) CloseHandle(Mapping);
+            CloseHandle(File);
+            Map->Size = 0;
+            return false;
         }
+        Map->Handle = (s64)Mapping;
     }
+    CloseHandle(File); // The mapping keeps the file alive.
 
-    CloseHandle(ProcessInfo.hProcess);
-    CloseHandle(ProcessInfo.hThread);
-    Free(CommandW.Wchars);
+    return true;
+}
 
-    return (int)ExitCode;
+void UnmapFile(mapped_file *Map) {
+    if (Map->Data) UnmapViewOfFile(Map->Data);
+    if (Map->Handle) CloseHandle((HANDLE)Map->Handle);
+    Map->Data   = NULL;
+    Map->Size   = 0;
+    Map->Handle = 0;
+}
+
+s64 OpenInput(str *Path) {
+    if (Path->Equal(str("-"))) return (s64)GetStdHandle(STD_INPUT_HANDLE);
+
+    auto PathW = UTF8ToWide(Path);
+    HANDLE File = CreateFileW(PathW.Wchars, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    Free(PathW.Wchars);
+    return (File == INVALID_HANDLE_VALUE) ? -1 : (s64)File;
+}
+
+s64 ReadInput(s64 Handle, void *Buffer, usize Size) {
+    DWORD Read = 0;
+    if (!ReadFile((HANDLE)Handle, Buffer, (DWORD)MIN(Size, (usize)GIGABYTES(1)), &Read, NULL)) {
+        return (GetLastError() == ERROR_BROKEN_PIPE) ? 0 : -1; // The writer is gone.
+    }
+    return (s64)Read;
+}
+
+void CloseInput(s64 Handle) {
+    if ((HANDLE)Handle != GetStdHandle(STD_INPUT_HANDLE)) CloseHandle((HANDLE)Handle);
+}
+
+bool ReplaceWithHardLink(str *Existing, str *Path) {
+    auto ExistingW = UTF8ToWide(Existing);
+    auto PathW     = UTF8ToWide(Path);
+    auto TemporaryW = MallocCount<wchar_t>(PathW.Size / sizeof(wchar_t) + 32);
+    swprintf(TemporaryW, PathW.Size / sizeof(wchar_t) + 32, L"%ls.fef-link-%lu", PathW.Wchars, GetCurrentProcessId());
+
+    bool Result = CreateHardLinkW(TemporaryW, ExistingW.Wchars, NULL);
+    if (Result && !MoveFileExW(TemporaryW, PathW.Wchars, MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileW(TemporaryW);
+        Result = false;
+    }
+
+    Free(TemporaryW);
+    Free(PathW.Wchars);
+    Free(ExistingW.Wchars);
+    return Result;
+}
+
+// A plain copy: block cloning is only for ReFS, and takes a lot more than this.
+bool CloneFile(str *Existing, str *Path) {
+    auto ExistingW = UTF8ToWide(Existing);
+    auto PathW     = UTF8ToWide(Path);
+    auto TemporaryW = MallocCount<wchar_t>(PathW.Size / sizeof(wchar_t) + 48);
+    static LONG Clones;
+    swprintf(TemporaryW, PathW.Size / sizeof(wchar_t) + 48, L"%ls.fef-clone-%lu-%ld", PathW.Wchars, GetCurrentProcessId(), InterlockedIncrement(&Clones));
+
+    bool Result = CopyFileW(ExistingW.Wchars, TemporaryW, TRUE);
+    if (Result && !MoveFileExW(TemporaryW, PathW.Wchars, MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileW(TemporaryW);
+        Result = false;
+    }
+
+    Free(TemporaryW);
+    Free(PathW.Wchars);
+    Free(ExistingW.Wchars);
+    return Result;
+}
+
+// Windows has no page cache hints for a file by name.
+void AdviseFile(str *Path, file_advice::file_advice Advice) {
+}
+
+struct thread_start {
+    thread_function Function;
+    void *Argument;
+};
+
+static DWORD WINAPI ThreadStart(LPVOID Start_) {
+    auto Start = *(thread_start *)Start_;
+    Free(Start_);
+    Start.Function(Start.Argument);
+    return 0;
+}
+
+thread StartThread(thread_function Function, void *Argument) {
+    auto Start = MallocCount<thread_start>(1);
+    Start->Function = Function;
+    Start->Argument = Argument;
+
+    HANDLE Thread = CreateThread(NULL, 0, ThreadStart, Start, 0, NULL);
+    if (!Thread) {
+        auto Error = LastError();
+        Printf(c_dim_red "[E]" c_grey " Failed to create a thread: " c_dim_red FSTR c_default "\n", (int)Error.Size, Error.Chars);
+        Exit(-1);
+    }
+    return (thread)Thread;
+}
+
+void JoinThread(thread Thread) {
+    WaitForSingleObject((HANDLE)Thread, INFINITE);
+    CloseHandle((HANDLE)Thread);
+}
+
+semaphore MakeSemaphore() {
+    HANDLE Semaphore = CreateSemaphoreW(NULL, 0, MAXLONG, NULL);
+    if (!Semaphore) {
+        auto Error = LastError();
+        Printf(c_dim_red "[E]" c_grey " Failed to create a semaphore: " c_dim_red FSTR c_default "\n", (int)Error.Size, Error.Chars);
+        Exit(-1);
+    }
+    return (semaphore)Semaphore;
+}
+
+void SignalSemaphore(semaphore Semaphore, uint Count) {
+    ReleaseSemaphore((HANDLE)Semaphore, (LONG)Count, NULL);
+}
+
+void WaitSemaphore(semaphore Semaphore) {
+    WaitForSingleObject((HANDLE)Semaphore, INFINITE);
+}
+
+void FreeSemaphore(semaphore Semaphore) {
+    CloseHandle((HANDLE)Semaphore);
+}
+
+u64 Nanoseconds() {
+    static LARGE_INTEGER Frequency;
+    if (Frequency.QuadPart == 0) QueryPerformanceFrequency(&Frequency);
+
+    LARGE_INTEGER Counter;
+    QueryPerformanceCounter(&Counter);
+    return (u64)(Counter.QuadPart / Frequency.QuadPart) * 1000000000llu
+         + (u64)(Counter.QuadPart % Frequency.QuadPart) * 1000000000llu / (u64)Frequency.QuadPart;
+}
+
+void SleepNanoseconds(u64 Duration) {
+    Sleep((DWORD)((Duration + 999999) / 1000000));
+}
+
+uint CpuCount() {
+    SYSTEM_INFO Info;
+    GetSystemInfo(&Info);
+    return Info.dwNumberOfProcessors ? Info.dwNumberOfProcessors : 1;
+}
+
+// Windows has neither pressure stall information nor a load average.
+void SampleSystemPressure(system_pressure *Pressure) {
+    Pressure->Cpu         = -1;
+    Pressure->Memory      = -1;
+    Pressure->Io          = -1;
+    Pressure->LoadAverage = -1;
+
+    MEMORYSTATUSEX Status = {};
+    Status.dwLength = sizeof(Status);
+    Pressure->MemoryAvailable = GlobalMemoryStatusEx(&Status) ? Status.ullAvailPhys : 0;
 }
 
 wchar_t *StrWCopy(wchar_t *Dst, str *Src) {
@@ -431,6 +825,24 @@ file_type::file_type FileType(str *Path) {
         return file_type::File;
 }
 
+bool MakeDirectory(str *Path) {
+    auto PathW = UTF8ToWide(Path);
+    BOOL Made = CreateDirectoryW(PathW.Wchars, NULL);
+    DWORD Error = GetLastError();
+    Free(PathW.Wchars);
+    if (Made) return true;
+    return Error == ERROR_ALREADY_EXISTS && FileType(Path) == file_type::Directory;
+}
+
+bool RenamePath(str *Path, str *NewPath) {
+    auto PathW    = UTF8ToWide(Path);
+    auto NewPathW = UTF8ToWide(NewPath);
+    bool Result = MoveFileExW(PathW.Wchars, NewPathW.Wchars, 0); // No MOVEFILE_COPY_ALLOWED: a copy is not instant.
+    Free(NewPathW.Wchars);
+    Free(PathW.Wchars);
+    return Result;
+}
+
 wchar_t * StrWDup(wchar_t *String) {
     usize Size = 0;
     for (auto C = String; *C != L'\0'; ++C) {
@@ -441,7 +853,13 @@ wchar_t * StrWDup(wchar_t *String) {
     return Result;
 }
 
-void DeleteDirectory_(wchar_t *Path, wchar_t *PathEnd) {
+// After a failed removal: the entry is not there (any more), which is what was wanted.
+static bool AlreadyGone() {
+    auto Error = GetLastError();
+    return Error == ERROR_FILE_NOT_FOUND || Error == ERROR_PATH_NOT_FOUND;
+}
+
+void DeleteDirectory_(wchar_t *Path, wchar_t *PathEnd, throttle *Throttle) {
     PathEnd[0] = L'*'; PathEnd[1] = L'\0';
 
     HANDLE FindHandle = NULL;
@@ -450,13 +868,14 @@ void DeleteDirectory_(wchar_t *Path, wchar_t *PathEnd) {
         if (FileInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
             auto End = StrWCopy(PathEnd, FileInfo.cFileName);
             End[0] = L'\\'; End[1] = L'\0';
-            DeleteDirectory_(Path, &End[1]);
+            DeleteDirectory_(Path, &End[1], Throttle);
             PathEnd[0] = L'*'; PathEnd[1] = L'\0';
         } else {
             auto End = StrWCopy(PathEnd, FileInfo.cFileName);
-            if (!DeleteFileW(Path)) {
+            ThrottleWait(Throttle, 1, 0);
+            if (!DeleteFileW(Path) && !AlreadyGone()) {
                 SetFileAttributesW(Path, FILE_ATTRIBUTE_NORMAL);
-                if (!DeleteFileW(Path)) {
+                if (!DeleteFileW(Path) && !AlreadyGone()) {
                     auto TMP = WideToUTF8(Path);
                     auto Error = LastError();
                     Printf(c_red "[E]" c_grey "Failed to remove file: " c_yellow FSTR c_default FSTR "\n", (int)TMP.Size, TMP.Chars, (int)Error.Size, Error.Chars);
@@ -472,9 +891,10 @@ void DeleteDirectory_(wchar_t *Path, wchar_t *PathEnd) {
     PathEnd[0] = '\0';
 
     PathEnd[0] = L'\0';
-    if (!RemoveDirectoryW(Path)) {
+    ThrottleWait(Throttle, 1, 0);
+    if (!RemoveDirectoryW(Path) && !AlreadyGone()) {
         SetFileAttributesW(Path, FILE_ATTRIBUTE_NORMAL);
-        if (!RemoveDirectoryW(Path)) {
+        if (!RemoveDirectoryW(Path) && !AlreadyGone()) {
             auto TMP = WideToUTF8(Path);
             auto Error = LastError();
             Printf("Failed to remove directory [" FSTR "]: (" FSTR ")\n", (int)TMP.Size, TMP.Chars, (int)Error.Size, Error.Chars);
@@ -486,16 +906,17 @@ void DeleteDirectory_(wchar_t *Path, wchar_t *PathEnd) {
     }
 }
 
-void Delete(str *Path) {
+void Delete(str *Path, throttle *Throttle) {
     auto PathBuffer = MallocCount<wchar_t>(32767 + 1);
     auto PathEnd    = StrWCopy(PathBuffer, Path);
 
     switch (FileType(Path)) {
         case file_type::Directory: {
             if (PathEnd[-1] != L'\\') *PathEnd++ = L'\\';
-            DeleteDirectory_(PathBuffer, PathEnd);
+            DeleteDirectory_(PathBuffer, PathEnd, Throttle);
         } break;
         case file_type::File: {
+            ThrottleWait(Throttle, 1, 0);
             DeleteFileW(PathBuffer);
         } break;
         case file_type::Invalid: {
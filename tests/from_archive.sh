@@ -0,0 +1,65 @@
+#!/bin/sh
+# "--from-archive" on small GNU, pax and ustar archives: a name too long for the 100 byte
+# field (a GNU 'L' header, a pax 'x' record, the ustar prefix), a file of exactly one 512
+# byte block, an empty one, and an archive cut short in the middle of its last member.
+# Every member has to come out under its name with its bytes on :stdin.
+#
+# Usage: tests/from_archive.sh [path to fef, default bin/main]
+
+fef=$(cd "$(dirname "${1:-bin/main}")" && pwd)/$(basename "${1:-bin/main}")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+cat > "$work/record.sh" <<'EOF'
+#!/bin/sh
+echo "$1 $(cksum | cut -d ' ' -f 1,2)" >> "$2"
+EOF
+chmod +x "$work/record.sh"
+
+long=directory_with_a_rather_long_name_number_one/directory_with_a_rather_long_name_number_two
+mkdir -p "$work/src/$long" || exit 1
+cd "$work/src" || exit 1
+echo "short" > short.txt
+: > empty.txt
+awk 'BEGIN { for (i = 0; i < 512; ++i) printf "%c", 65 + i % 26 }' > block.bin
+echo "at the end of a long name" > "$long/file_whose_whole_path_is_longer_than_one_hundred_bytes.txt"
+awk 'BEGIN { for (i = 0; i < 3000; ++i) printf "%d\n", i }' > last.txt
+members="short.txt empty.txt block.bin $long/file_whose_whole_path_is_longer_than_one_hundred_bytes.txt last.txt"
+
+failed=0
+fail() {
+    echo "FAILED: from_archive ($1)"
+    [ -f "$work/output.txt" ] && cat "$work/output.txt"
+    failed=1
+}
+
+# What record.sh should see for the members named, sorted.
+expected() {
+    for member in "$@"; do echo "$member $(cksum < "$member" | cut -d ' ' -f 1,2)"; done | sort
+}
+
+for format in gnu pax ustar; do
+    tar --format=$format -b 1 -cf "$work/$format.tar" $members || exit 1 # No padding past the end blocks.
+    rm -f "$work/seen.txt"
+    "$fef" --files -j 4 --from-archive "$work/$format.tar" "$work/record.sh" :name :stdin "$work/seen.txt" > "$work/output.txt" 2>&1
+    if [ $? -ne 0 ] || grep -q "\[[EW]\]" "$work/output.txt"; then fail "$format"; continue; fi
+    if [ "$(sort "$work/seen.txt")" != "$(expected $members)" ]; then
+        fail "$format members"
+        sort "$work/seen.txt"
+    fi
+done
+
+# Cut in the middle of last.txt's content: the members before it still run, with a warning.
+size=$(wc -c < "$work/gnu.tar")
+head -c $((size - 1024 - 4000)) "$work/gnu.tar" > "$work/cut.tar"
+rm -f "$work/seen.txt"
+"$fef" --files --from-archive "$work/cut.tar" "$work/record.sh" :name :stdin "$work/seen.txt" > "$work/output.txt" 2>&1
+if [ $? -ne 0 ] || ! grep -q "cut short" "$work/output.txt"; then
+    fail "truncated"
+elif [ "$(sort "$work/seen.txt")" != "$(expected short.txt empty.txt block.bin $long/file_whose_whole_path_is_longer_than_one_hundred_bytes.txt)" ]; then
+    fail "truncated members"
+    sort "$work/seen.txt"
+fi
+
+[ $failed -ne 0 ] && exit 1
+echo "OK: from_archive"
@@ -0,0 +1,36 @@
+#!/bin/sh
+# "-r --del -j 8" on a nested tree: no directory may be thrown away while commands on
+# what is in it still run. Files take a while and directories are done at once, so
+# without the ordering a directory would go first.
+#
+# Usage: tests/recursive_del.sh [path to fef, default bin/main]
+
+fef=$(cd "$(dirname "${1:-bin/main}")" && pwd)/$(basename "${1:-bin/main}")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+cat > "$work/slow_cat.sh" <<'EOF'
+#!/bin/sh
+[ -d "$1" ] && exit 0
+sleep 0.1
+cat "$1" > /dev/null
+EOF
+chmod +x "$work/slow_cat.sh"
+
+mkdir "$work/tree" && cd "$work/tree" || exit 1
+for dir in a a/b a/b/c a/d e e/f e/f/g e/f/g/h; do
+    mkdir -p $dir
+    for i in 1 2 3 4 5 6; do echo "$dir $i" > $dir/file$i; done
+done
+
+"$fef" -r --del -j 8 "$work/slow_cat.sh" :name > "$work/output.txt" 2>&1
+result=$?
+
+left=$(find . -mindepth 1 ! -name .fef-trash | head -n 10)
+if [ $result -ne 0 ] || grep -q "\[E\]" "$work/output.txt" || [ -n "$left" ]; then
+    echo "FAILED: recursive_del"
+    cat "$work/output.txt"
+    [ -n "$left" ] && echo "Left over:" && echo "$left"
+    exit 1
+fi
+echo "OK: recursive_del"